@@ -0,0 +1,61 @@
+#!/bin/bash
+
+# Times the programs in this directory with -run as x86-64 code, on the register VM, the stack VM and the tree,
+# as an executable written by -elf, as simulation.s from -asm built by as and ld, and as simulation.cpp built by
+# g++ -O0 and -O2 (the -elf, -asm and g++ times are build + run, the -run times include compiling). Run from the
+# repository root: bench/bench.sh
+# Each program reads its size from stdin, the sizes are below.
+
+set -e
+root=$(pwd)
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+
+g++ -O2 -pthread -o "$work/code_gen" code_gen.cpp
+cd "$work"
+
+TIMEFORMAT=%R
+seconds() {
+    { time "$@" > /dev/null 2>&1; } 2>&1
+}
+
+build_asm() {
+    ./code_gen "$1" -asm && as -o simulation.o simulation.s && ld -o sim_asm simulation.o
+}
+
+printf "%-14s %10s %10s %10s %10s %16s %16s %16s %16s\n" program jit register stack tree elf asm "g++ -O0" "g++ -O2"
+for bench in "factorial 200000" "nested_loops 300" "arith 5000000"; do
+    set -- $bench
+    program=$root/bench/$1.txt
+    echo $2 > size.txt
+
+    jit=$(seconds ./code_gen "$program" -run=jit < size.txt)
+    register=$(seconds ./code_gen "$program" -run=register < size.txt)
+    stack=$(seconds ./code_gen "$program" -run=stack < size.txt)
+    tree=$(seconds ./code_gen "$program" -run=tree < size.txt)
+
+    build_elf=$(seconds ./code_gen "$program" -elf)
+    run_elf=$(seconds ./simulation < size.txt)
+    ./simulation < size.txt > elf.out
+    build_asm=$(seconds build_asm "$program")
+    run_asm=$(seconds ./sim_asm < size.txt)
+    ./sim_asm < size.txt > asm.out
+
+    ./code_gen "$program" > /dev/null
+    build0=$(seconds g++ -O0 -o sim0 simulation.cpp)
+    build2=$(seconds g++ -O2 -o sim2 simulation.cpp)
+    run0=$(seconds ./sim0 < size.txt)
+    run2=$(seconds ./sim2 < size.txt)
+
+    # the engines must agree before their times mean anything
+    ./sim2 < size.txt > sim.out
+    for engine in jit register stack tree; do
+        ./code_gen "$program" -run=$engine < size.txt > $engine.out
+        cmp -s $engine.out sim.out || echo "$1: the output of -run=$engine differs"
+    done
+    cmp -s elf.out sim.out || echo "$1: the output of -elf differs"
+    cmp -s asm.out sim.out || echo "$1: the output of -asm differs"
+
+    printf "%-14s %10s %10s %10s %10s %16s %16s %16s %16s\n" $1 $jit $register $stack $tree "$build_elf + $run_elf" \
+        "$build_asm + $run_asm" "$build0 + $run0" "$build2 + $run2"
+done
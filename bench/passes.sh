@@ -0,0 +1,57 @@
+#!/bin/bash
+
+# Compares the passes over the pointer tree with those over the FlatTree (-flat) on a generated program of about
+# MB megabytes (16 by default): the time and the last level cache misses of each pass, the best of three runs of a
+# build with TINY_PASS_STATS. The misses need a kernel that gives the process its performance counters (see
+# /proc/sys/kernel/perf_event_paranoid), they are "-" where it does not. Run from the repository root:
+# bench/passes.sh [MB]
+
+set -e
+mb=${1:-16}
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+
+g++ -O2 -pthread -DTINY_PASS_STATS=1 -o "$work/code_gen" code_gen.cpp
+cd "$work"
+
+awk -v mb="$mb" 'BEGIN {
+    for (i = 0; bytes < mb * 1048576; i++) {
+        block = sprintf("{ block %d }\n", i) \
+                "read value;\n" \
+                "if count < 100 then\n" \
+                "    repeat\n" \
+                "        total := total + value * 3 - (count / 2) ^ 2;\n" \
+                "        count := count + 1\n" \
+                "    until 50 < count\n" \
+                "else\n" \
+                "    count := 0\n" \
+                "end;\n"
+        printf "%s", block
+        bytes += length(block)
+    }
+    print "write total"
+}' > program.txt
+echo "program: $(wc -c < program.txt) bytes"
+
+# Runs the compiler three times and prints the stats of each pass, the best time and the fewest misses
+stats() {
+    local i
+    for i in 1 2 3; do
+        ./code_gen program.txt "$@" 2>&1 > /dev/null | grep '^pass '
+    done | awk '{
+        if (!($2 in time)) { order[n++] = $2; time[$2] = $3; misses[$2] = $5 }
+        if ($3 < time[$2]) time[$2] = $3
+        if ($5 != "-" && $5 < misses[$2]) misses[$2] = $5
+    } END { for (i = 0; i < n; i++) print order[i], time[order[i]], misses[order[i]] }'
+}
+
+stats > pointer.txt
+stats -flat > flat.txt
+./code_gen program.txt > pointer.out 2> /dev/null && mv simulation.cpp pointer.cpp
+./code_gen program.txt -flat > flat.out 2> /dev/null
+cmp -s pointer.out flat.out && cmp -s pointer.cpp simulation.cpp || echo "the output of -flat differs"
+
+printf "%-10s %12s %12s %16s %16s\n" pass "pointer s" "flat s" "pointer misses" "flat misses"
+awk 'NR == FNR { time[$1] = $2; misses[$1] = $3; next }
+     { printf "%-10s %12s %12s %16s %16s\n", $1, ($1 in time) ? time[$1] : "", $2,
+              ($1 in misses) ? misses[$1] : "", $3 }' pointer.txt flat.txt
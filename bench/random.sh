@@ -0,0 +1,123 @@
+#!/bin/bash
+
+# Checks that the engines agree on COUNT random programs (200 by default, from seed SEED, 1 by default): each
+# program runs with -run=tree, and then with the other -run engines, as the executables of -elf and -asm and as
+# simulation.cpp built by g++ (from the pointer tree, -flat and -stream), which must print the same. The programs
+# read or set their variables first, then mix writes, assignments, ifs and counted repeats with expressions that use
+# every operator, with constants on either side that ReduceStrength() rewrites, and exponents that wrap to negative
+# numbers. Run from the repository root: bench/random.sh [COUNT [SEED]]
+
+root=$(pwd)
+count=${1:-200}
+seed=${2:-1}
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+
+g++ -O2 -pthread -o "$work/code_gen" code_gen.cpp || exit 1
+cd "$work"
+printf '%s\n' 3 -7 2147483647 -2147483648 12 -1 0 5 x 9 > input.txt
+failed=0
+
+# generate SEED: prints a random program
+generate() {
+    awk -v seed=$1 '
+    function pick(list,   n, items) {
+        n = split(list, items, " ")
+        return items[int(rand() * n) + 1]
+    }
+    function operand(   name) {
+        if (rand() < 0.6) {
+            name = pick(vars)
+            if (num_counters && rand() < 0.3) name = counter[int(rand() * num_counters)]
+            return name
+        }
+        return int(rand() * 21)
+    }
+    function expr(depth,   oper, a, b, t) {
+        if (depth <= 0 || rand() < 0.3) return operand()
+        oper = pick("+ - * / ^ + - * /c *c ^c")
+        a = expr(depth - 1)
+        b = expr(depth - 1)
+        if (oper == "^") b = int(rand() * 4)
+        if (oper ~ /c$/) {
+            oper = substr(oper, 1, 1)
+            b = pick(constants[oper])
+            if (rand() < 0.3) { t = a; a = b; b = t }
+        }
+        if (oper == "/" && rand() < 0.7) b = "(" b "*" b "+1)"
+        return "(" a oper b ")"
+    }
+    function stmts(depth, n,   out, i, r, s, c) {
+        out = ""
+        for (i = 0; i < n; i++) {
+            r = rand()
+            if (r < 0.35) s = pick(vars) " := " expr(int(rand() * 5))
+            else if (r < 0.55) s = "write " (rand() < 0.5 ? pick(vars) : expr(3))
+            else if (r < 0.75 && depth < 3) {
+                s = "if " expr(2) pick("< =") expr(2) " then " stmts(depth + 1, int(rand() * 3) + 1)
+                if (rand() < 0.5) s = s " else " stmts(depth + 1, int(rand() * 3) + 1)
+                s = s " end"
+            } else if (depth < 3 && num_counters < 8) {
+                c = "c" substr("abcdefgh", num_counters + 1, 1)
+                counter[num_counters++] = c
+                s = stmts(depth + 1, int(rand() * 4) + 1)
+                num_counters--
+                s = c " := " (int(rand() * 6) + 1) "; repeat " s "; " c " := " c " - 1 until " c " < 1"
+            } else continue
+            out = out (out == "" ? "" : "; ") s
+        }
+        return out == "" ? "write 1" : out
+    }
+    BEGIN {
+        srand(seed)
+        constants["/"] = "1 2 3 4 5 6 7 8 10 16 100 641 1000 65536 1000003 1073741824 2147483647"
+        constants["*"] = "0 1 2 3 4 8 1024 65536 1073741824"
+        # 2147483648 and up wrap to negative exponents, which IntPow() gives 0, 1 or -1 for
+        constants["^"] = "0 1 2 3 4 5 7 13 31 32 33 100 2147483647 2147483648 4294967293 4294967294 4294967295"
+        vars = substr("va vb vc vd ve vf vg vh vi vj vk vl vm vn", 1, 3 * pick("2 4 7 10 14") - 1)
+        # simulation.cpp declares a variable on the line where it first appears and at each read, so each is read
+        # or set on a line of its own first
+        n = split(vars, names, " ")
+        for (i = 1; i <= n; i++) printf (rand() < 0.5 ? "read %s;\n" : "%s := 0;\n"), names[i]
+        n = split("ca cb cc cd ce cf cg ch", names, " ")
+        for (i = 1; i <= n; i++) printf "%s := 0;\n", names[i]
+        print stmts(0, int(rand() * 10) + 3)
+    }'
+}
+
+# same NAME EXPECTED_STATUS STATUS: the output and errors in NAME.out and NAME.err must be those of -run=tree
+same() {
+    if [ "$2" != "$3" ] || ! cmp -s tree.out $1.out || ! cmp -s tree.err $1.err; then
+        echo "FAILED seed $s: $1 differs from -run=tree"
+        cp program.txt "$root/random_$s.txt"
+        failed=1
+    fi
+}
+
+for s in $(seq $seed $((seed + count - 1))); do
+    generate $s > program.txt
+    ./code_gen program.txt -run=tree < input.txt > tree.out 2> tree.err
+    expected=$?
+    for engine in stack register jit; do
+        ./code_gen program.txt -run=$engine < input.txt > $engine.out 2> $engine.err
+        same $engine $expected $?
+    done
+
+    ./code_gen program.txt -elf > /dev/null
+    timeout 10 ./simulation < input.txt > elf.out 2> elf.err
+    same elf $expected $?
+    ./code_gen program.txt -asm > /dev/null && as -o simulation.o simulation.s && ld -o sim_asm simulation.o
+    timeout 10 ./sim_asm < input.txt > asm.out 2> asm.err
+    same asm $expected $?
+
+    # the generated C++ crashes where -run stops with an error, and loses its buffered output, so it is only
+    # compared on programs that end normally
+    [ $expected = 0 ] || continue
+    for options in "" -flat -stream; do
+        ./code_gen program.txt $options > /dev/null && g++ -w -o sim simulation.cpp
+        timeout 10 ./sim < input.txt > g++$options.out 2> g++$options.err
+        same g++$options $expected $?
+    done
+done
+echo "$count programs"
+exit $failed
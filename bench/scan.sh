@@ -0,0 +1,117 @@
+#!/bin/bash
+
+# Times the scanner alone on generated sources of about MB megabytes (32 by default): this build with -scan, and
+# the scanners of the commits before and after the DFA replaced the symbolic_tokens scan, built from git with
+# bench/scan_tokens.cpp. Then this build with each set of skip kernels (TINY_SCAN_KERNEL) on code, on comment
+# banners and on indented code. Last the code source with -j1 (the serial scan), -j2, -j4 and -j8.
+# Run from the repository root of a git clone: bench/scan.sh [MB]
+
+set -e
+root=$(pwd)
+mb=${1:-32}
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+
+# the commit that replaced the symbolic_tokens scan by the DFA, found by its subject so that it survives a rebase,
+# and its parent, the last commit with the symbolic_tokens scan
+dfa_scanner=$(git log --format=%h --reverse -F --grep='Replace the symbolic_tokens scan with a table-driven DFA' |
+              head -n 1)
+if [ -z "$dfa_scanner" ]; then
+    echo "no commit replaces the symbolic_tokens scan by the DFA in this history" >&2
+    exit 1
+fi
+old_scanner=$dfa_scanner^
+
+g++ -O2 -pthread -o "$work/code_gen" code_gen.cpp
+for build in old_scanner dfa_scanner; do
+    git show ${!build}:code_gen.cpp > "$work/$build.cpp"
+    g++ -O2 -I "$work" -DCODE_GEN="\"$build.cpp\"" -o "$work/$build" bench/scan_tokens.cpp
+done
+cd "$work"
+
+# A program of about mb megabytes made of blocks of one kind:
+# code        statements with a short comment
+# comments    a few statements under a banner of comment lines
+# indented    statements deep in nested ifs, with long names
+generate() {
+    awk -v kind="$1" -v mb="$2" 'BEGIN {
+        banner = "{" sprintf("%78s", "") "}\n"
+        gsub(/ /, "=", banner)
+        for (i = 0; bytes < mb * 1048576; i++) {
+            if (kind == "code")
+                block = sprintf("{ block %d: the total of the values read so far }\n", i) \
+                        "read value;\n" \
+                        "total := total + value * 3 - (count / 2) ^ 2;\n" \
+                        "if count < 100 then\n    count := count + 1\nelse\n    count := 0\nend;\n"
+            else if (kind == "comments")
+                block = banner sprintf("{ section %d\n  of the program, explaining what the statements below\n", i) \
+                        "  compute and why, over several lines of plain text }\n" banner \
+                        "total := total + 1;\n"
+            else
+                block = "if running_total < maximum_value then\n" \
+                        "                if current_count < maximum_count then\n" \
+                        "                                running_total := running_total + current_value;\n" \
+                        "                                current_count := current_count + 1\n" \
+                        "                end\nend;\n"
+            printf "%s", block
+            bytes += length(block)
+        }
+        print "write total"
+    }'
+}
+
+TIMEFORMAT=%R
+# The best of three runs in seconds
+best() {
+    local i t best=
+    for i in 1 2 3; do
+        t=$({ time "$@" > /dev/null 2>&1; } 2>&1)
+        if [ -z "$best" ] || awk -v t=$t -v b=$best 'BEGIN { exit !(t < b) }'; then best=$t; fi
+    done
+    echo $best
+}
+
+# MB/s of a source for a time in seconds
+rate() {
+    awk -v bytes=$(wc -c < "$1") -v t=$2 'BEGIN { printf "%.0f", (t > 0 ? bytes / 1048576 / t : 0) }'
+}
+
+generate code $mb > code.txt
+tokens=$(./code_gen code.txt -scan)
+echo "source: $(wc -c < code.txt) bytes, $tokens"
+for build in old_scanner dfa_scanner; do
+    [ "$(./$build code.txt)" = "${tokens%%,*}" ] || echo "$build finds a different number of tokens"
+done
+
+printf "%-16s %10s %10s\n" scanner seconds MB/s
+for build in old_scanner dfa_scanner; do
+    t=$(best ./$build code.txt)
+    printf "%-16s %10s %10s\n" $build $t $(rate code.txt $t)
+done
+t=$(best ./code_gen code.txt -scan)
+printf "%-16s %10s %10s\n" "this build" $t $(rate code.txt $t)
+
+echo
+printf "%-16s %10s %10s %10s   (MB/s)\n" source scalar sse2 avx2
+for kind in code comments indented; do
+    generate $kind $mb > $kind.txt
+    rates=
+    for kernel in scalar sse2 avx2; do
+        used=$(TINY_SCAN_KERNEL=$kernel ./code_gen $kind.txt -scan)
+        if [ "${used#*, }" = "$kernel kernels" ]; then
+            rates="$rates $(rate $kind.txt $(TINY_SCAN_KERNEL=$kernel best ./code_gen $kind.txt -scan))"
+        else
+            rates="$rates -" # not on this CPU
+        fi
+    done
+    printf "%-16s %10s %10s %10s\n" $kind $rates
+done
+
+echo
+echo "threads on $(nproc) cores"
+printf "%-16s %10s %10s\n" "" seconds MB/s
+for threads in 1 2 4 8; do
+    [ "$(./code_gen code.txt -scan -j$threads)" = "$tokens" ] || echo "-j$threads finds a different number of tokens"
+    t=$(best ./code_gen code.txt -scan -j$threads)
+    printf "%-16s %10s %10s\n" -j$threads $t $(rate code.txt $t)
+done
@@ -0,0 +1,19 @@
+// Scans a source with the GetNextToken() of an older code_gen.cpp, the file named by CODE_GEN, and prints the
+// number of tokens like code_gen -scan. The builds before the DFA scanner had no -scan (see bench/scan.sh).
+// g++ -O2 -DCODE_GEN='"old.cpp"' -o scan_tokens bench/scan_tokens.cpp
+
+#define main code_gen_main
+#include CODE_GEN
+#undef main
+
+int main(int argc, char **argv) {
+    CompilerInfo ci(argc > 1 ? argv[1] : "input.txt", "output.txt", "debug.txt");
+    Token token;
+    size_t num_tokens = 0;
+    do {
+        GetNextToken(&ci, &token);
+        num_tokens++;
+    } while (token.type != ENDFILE && token.type != ERROR);
+    printf("%zu tokens\n", num_tokens);
+    return 0;
+}
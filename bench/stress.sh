@@ -0,0 +1,60 @@
+#!/bin/bash
+
+# Checks that long and deeply nested programs compile and run with an 8 MB stack, since the parser and the passes
+# over the tree must not recurse: STATEMENTS statements in a row (10 million by default), and DEPTH levels
+# (100000 by default) of nested parentheses, of operators nested through parentheses, of a ^ chain and of nested
+# if and repeat statements. Run from the repository root: bench/stress.sh [STATEMENTS [DEPTH]]
+
+root=$(pwd)
+statements=${1:-10000000}
+depth=${2:-100000}
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+
+g++ -O2 -pthread -o "$work/code_gen" code_gen.cpp || exit 1
+cd "$work"
+ulimit -s 8192
+failed=0
+
+# check NAME EXPECTED [OPTIONS]: compiles NAME.txt with OPTIONS, with -run the program's output must be EXPECTED
+check() {
+    local name=$1 expected=$2
+    shift 2
+    ./code_gen $name.txt "$@" > out.txt 2> err.txt
+    local status=$?
+    if [ $status != 0 ] || [ -s err.txt ] || { [[ "$*" == -run* ]] && [ "$(cat out.txt)" != "$expected" ]; }; then
+        echo "FAILED $name $* (exit status $status)"
+        head -c 300 err.txt
+        failed=1
+    else
+        echo "ok     $name $*"
+    fi
+}
+
+awk -v n=$statements 'BEGIN { for (i = 0; i < n; i++) print "x := x + 1;"; print "write x" }' > statements.txt
+awk -v n=$depth 'BEGIN {
+    s = "x := "; for (i = 0; i < n; i++) s = s "("; s = s "1"; for (i = 0; i < n; i++) s = s ")"
+    print s "; write x" }' > parens.txt
+awk -v n=$depth 'BEGIN {
+    s = "x := "; for (i = 0; i < n; i++) s = s "("; s = s "0"; for (i = 0; i < n; i++) s = s " + 1)"
+    print s "; write x" }' > operators.txt
+awk -v n=$depth 'BEGIN { s = "x := 2"; for (i = 0; i < n; i++) s = s " ^ 1"; print s "; write x" }' > power.txt
+awk -v n=$depth 'BEGIN {
+    for (i = 0; i < n; i++) print "if x < 1 then repeat"
+    print "x := x + 1"
+    for (i = 0; i < n; i++) print "until 0 < x end"
+    print "; write x" }' > nested.txt
+
+for options in -run=register -run=stack -run=tree -run=jit; do check statements "x: $statements" $options; done
+check statements "" -stream
+# the tree of the other programs is as deep as the program, too deep to print, so they are only run
+for options in "" -flat -stream -run=register -run=stack -run=tree -run=jit; do check parens "x: 1" $options; done
+for program in operators power nested; do
+    case $program in
+        operators) expected="x: $depth" ;;
+        power) expected="x: 2" ;;
+        nested) expected="x: 1" ;;
+    esac
+    for options in -run=register -run=stack -run=tree -run=jit; do check $program "$expected" $options; done
+done
+exit $failed
@@ -1,6 +1,53 @@
+#include <climits>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <algorithm>
+#include <new>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define TINY_HAVE_MMAP
+#endif
+
+#ifdef TINY_HAVE_MMAP
+#include <atomic>
+#include <thread>
+#endif
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+
+#define TINY_HAVE_SIMD
+#endif
+
+// labels as values, for the dispatch of RunBytecode()
+#if defined(__GNUC__) || defined(__clang__)
+#define TINY_HAVE_COMPUTED_GOTO
+#endif
+
+// the pass statistics count cache misses with the performance counters of Linux
+#if TINY_PASS_STATS
+#include <chrono>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+
+#define TINY_HAVE_PERF_EVENTS
+#endif
+#endif
+
+// the JIT emits x86-64 code for the System V calling convention into mapped memory
+#if defined(__x86_64__) && defined(TINY_HAVE_MMAP)
+#define TINY_HAVE_JIT
+#endif
 
 using namespace std;
 
@@ -44,91 +91,261 @@ bool StartsWith(const char *a, const char *b) {
     return strncmp(a, b, nb) == 0;
 }
 
-void Copy(char *a, const char *b, int n = 0) {
-    if (n > 0) {
-        strncpy(a, b, n);
-        a[n] = 0;
-    } else strcpy(a, b);
+// FNV-1a hash, the seed is the starting value
+constexpr unsigned HashWord(unsigned seed, const char *s, int len) {
+    unsigned h = seed;
+    for (int i = 0; i < len; i++) h = (h ^ (unsigned char) s[i]) * 16777619u;
+    return h;
 }
 
-void AllocateAndCopy(char **a, const char *b) {
-    if (b == 0) {
-        *a = 0;
-        return;
+// 64-bit hash for long texts: FNV-1a over 8-byte words, with a shift after every step that folds the high bits
+// of the product back into the low ones (the words are not mixed downwards by the multiply alone)
+unsigned long long HashBytes(unsigned long long h, const char *s, size_t len) {
+    size_t i;
+    for (i = 0; i + 8 <= len; i += 8) {
+        unsigned long long w;
+        memcpy(&w, &s[i], 8);
+        h = (h ^ w) * 1099511628211ull;
+        h ^= h >> 29;
     }
-    int n = strlen(b);
-    *a = new char[n + 1];
-    strcpy(*a, b);
+    for (; i < len; i++) h = (h ^ (unsigned char) s[i]) * 1099511628211ull;
+    return h ^ (h >> 32);
 }
 
+////////////////////////////////////////////////////////////////////////////////////
+// Arena ///////////////////////////////////////////////////////////////////////////
+
+#define ARENA_FIRST_BLOCK_SIZE (64 * 1024)
+#define ARENA_MAX_BLOCK_SIZE (16 * 1024 * 1024)
+
+// Bump allocator: objects are carved out of big blocks and never freed one by one. Reset() releases all
+// of them at once, keeping the newest (largest) block for the next allocations. Destructors are not run.
+struct Arena {
+    struct Block {
+        Block *prev;
+        size_t size;
+    };
+
+    Block *last; // the newest block, 0 if none
+    char *cur, *end; // the free part of last
+
+    Arena() {
+        last = 0;
+        cur = end = 0;
+    }
+
+    ~Arena() {
+        Reset();
+        if (last) delete[] (char *) last;
+    }
+
+    void *Allocate(size_t size) {
+        size = (size + 7) & ~(size_t) 7;
+        if (size > (size_t) (end - cur)) NewBlock(size);
+        void *p = cur;
+        cur += size;
+        return p;
+    }
+
+    // Blocks double in size up to ARENA_MAX_BLOCK_SIZE, so a big tree needs only a few of them
+    void NewBlock(size_t size) {
+        size_t block_size = ARENA_FIRST_BLOCK_SIZE;
+        if (last) block_size = last->size < ARENA_MAX_BLOCK_SIZE ? 2 * last->size : last->size;
+        while (block_size < size + sizeof(Block)) block_size *= 2;
+
+        Block *block = (Block *) new char[block_size];
+        block->prev = last;
+        block->size = block_size;
+        last = block;
+        cur = (char *) (block + 1);
+        end = (char *) block + block_size;
+    }
+
+    void Reset() {
+        if (!last) return;
+        Block *block = last->prev;
+        while (block) {
+            Block *prev = block->prev;
+            delete[] (char *) block;
+            block = prev;
+        }
+        last->prev = 0;
+        cur = (char *) (last + 1);
+    }
+};
+
 ////////////////////////////////////////////////////////////////////////////////////
 // Input and Output ////////////////////////////////////////////////////////////////
 
-#define MAX_LINE_LENGTH 10000
+#define LINE_BUF_SIZE 10000 // the first size of InFile::line_buf, it grows for longer lines
 
+// Readable bytes after the end of the text, so that the scanner can load 32 bytes at a time
+#define SCAN_PADDING 64
+
+// The source is read in one of two ways:
+// - mapped: the whole file is mapped once (followed by zero bytes), the scanner reads straight out of
+//   the mapping, and line numbers are only counted when somebody asks for them
+// - stdio: the file is read line by line with fgets into line_buf, which grows to hold the longest line,
+//   used when mapping is not possible (pipes, empty files, platforms without mmap), for streaming, and for
+//   "-" (stdin)
 struct InFile {
     FILE *file;
     int cur_line_num;
 
-    char line_buf[MAX_LINE_LENGTH];
+    char *line_buf; // line_cap bytes and SCAN_PADDING more
+    int line_cap;
     int cur_ind, cur_line_size;
+    size_t line_start; // offset of line_buf in the file
+
+    char *map_buf; // 0 when reading through stdio
+    size_t map_len; // size of the file
+    size_t map_size; // size of the mapping, always more than map_len
+    size_t cur_pos; // offset of the next byte to read
+    size_t line_pos; // newlines before line_pos are already counted in cur_line_num
 
-    InFile(const char *str) {
+    InFile(const char *str, bool map_file = true) {
         file = 0;
-        if (str) file = fopen(str, "r");
+        map_buf = 0;
+        map_len = map_size = 0;
+        cur_pos = line_pos = 0;
+        line_start = 0;
+        line_buf = new char[LINE_BUF_SIZE + SCAN_PADDING];
+        line_cap = LINE_BUF_SIZE;
         cur_line_size = 0;
         cur_ind = 0;
         cur_line_num = 0;
+        if (str && Equals(str, "-")) file = stdin;
+        else {
+            if (str && map_file) Map(str);
+            if (str && !map_buf) file = fopen(str, "r");
+        }
     }
 
-    ~InFile() { if (file) fclose(file); }
-
-    void SkipSpaces() {
-        while (cur_ind < cur_line_size) {
-            char ch = line_buf[cur_ind];
-            if (ch != ' ' && ch != '\t' && ch != '\r' && ch != '\n') break;
-            cur_ind++;
-        }
+    ~InFile() {
+        delete[] line_buf;
+        if (file && file != stdin) fclose(file);
+#ifdef TINY_HAVE_MMAP
+        if (map_buf) munmap(map_buf, map_size);
+#endif
     }
 
-    bool SkipUpto(const char *str) {
-        while (true) {
-            SkipSpaces();
-            while (cur_ind >= cur_line_size) {
-                if (!GetNewLine()) return false;
-                SkipSpaces();
+    // Maps the file so that at least SCAN_PADDING zero bytes follow its content.
+    // Leaves map_buf 0 if the file can not be mapped.
+    void Map(const char *str) {
+#ifdef TINY_HAVE_MMAP
+        int fd = open(str, O_RDONLY);
+        if (fd < 0) return;
+
+        struct stat st;
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+            size_t page = sysconf(_SC_PAGESIZE);
+            size_t len = st.st_size;
+            size_t size = (len + SCAN_PADDING + page - 1) / page * page;
+
+            // reserve zero-filled pages first, then map the file over their beginning
+            void *p = mmap(0, size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (p != MAP_FAILED) {
+                if (mmap(p, len, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) != MAP_FAILED) {
+                    map_buf = (char *) p;
+                    map_len = len;
+                    map_size = size;
+                    cur_line_num = 1;
+                } else munmap(p, size);
             }
+        }
+        close(fd);
+#endif
+    }
 
-            if (StartsWith(&line_buf[cur_ind], str)) {
-                cur_ind += strlen(str);
-                return true;
+    // Line number of the text at offset pos. In mapped mode it is counted lazily, and cheaply as long as
+    // pos does not go backwards. In stdio mode it is the current line, so only the last token can ask.
+    int LineNum(size_t pos) {
+        if (!map_buf) return cur_line_num;
+        if (pos < line_pos) {
+            line_pos = 0;
+            cur_line_num = 1;
+        }
+        while (line_pos < pos) {
+            const char *nl = (const char *) memchr(&map_buf[line_pos], '\n', pos - line_pos);
+            if (!nl) {
+                line_pos = pos;
+                break;
             }
-            cur_ind++;
+            cur_line_num++;
+            line_pos = nl - map_buf + 1;
         }
-        return false;
+        return cur_line_num;
     }
 
     bool GetNewLine() {
+        size_t next_line_start = line_start + cur_line_size;
         cur_ind = 0;
         line_buf[0] = 0;
-        if (!fgets(line_buf, MAX_LINE_LENGTH, file)) return false;
-        cur_line_size = strlen(line_buf);
-        if (cur_line_size == 0) return false; // End of file
+
+        // a full buffer without the newline is doubled and the rest of the line read after it
+        int size = 0;
+        while (fgets(&line_buf[size], line_cap - size, file)) {
+            size += strlen(&line_buf[size]);
+            if (size < line_cap - 1 || line_buf[size - 1] == '\n') break;
+            char *buf = new char[2 * line_cap + SCAN_PADDING];
+            memcpy(buf, line_buf, size + 1);
+            delete[] line_buf;
+            line_buf = buf;
+            line_cap *= 2;
+        }
+        if (size == 0) return false; // End of file
+        cur_line_size = size;
+        line_start = next_line_start;
         cur_line_num++;
         return true;
     }
 
-    char *GetNextTokenStr() {
-        SkipSpaces();
-        while (cur_ind >= cur_line_size) {
-            if (!GetNewLine()) return 0;
-            SkipSpaces();
-        }
+    // The current read position. The text that follows is zero terminated,
+    // in stdio mode it is only valid until the next line is read.
+    const char *Cur() {
+        if (map_buf) return &map_buf[cur_pos];
         return &line_buf[cur_ind];
     }
 
-    void Advance(int num) {
-        cur_ind += num;
+    size_t Offset(const char *p) {
+        if (map_buf) return p - map_buf;
+        return line_start + (p - line_buf);
+    }
+
+    // The text at offset pos, in stdio mode only for offsets in the current line
+    const char *Text(size_t pos) {
+        if (map_buf) return &map_buf[pos];
+        return &line_buf[pos - line_start];
+    }
+
+    // The offset reported for the end of file: LineNum() gives the line of the last character,
+    // as the stdio mode does
+    size_t EndPos() {
+        if (map_buf) return map_len - 1;
+        return line_start + cur_line_size;
+    }
+
+    void Seek(const char *p) {
+        if (map_buf) cur_pos = p - map_buf;
+        else cur_ind = p - line_buf;
+    }
+
+    // The end of the available text
+    const char *Limit() {
+        if (map_buf) return &map_buf[map_len];
+        return &line_buf[cur_line_size];
+    }
+
+    // true if p is the zero byte after the available text, false if it is a zero byte inside the text
+    bool AtEnd(const char *p) {
+        if (map_buf) return (size_t) (p - map_buf) >= map_len;
+        return p - line_buf >= cur_line_size;
+    }
+
+    // Makes the next line available at Cur(), the mapped mode has all lines available already
+    bool NextLine() {
+        if (map_buf) return false;
+        return GetNewLine();
     }
 };
 
@@ -148,6 +365,187 @@ struct OutFile {
     }
 };
 
+#define PRINT_BUFFER_SIZE (64 * 1024)
+
+// Collects output text and writes it with one fwrite per PRINT_BUFFER_SIZE bytes, for long listings that
+// would otherwise make a printf call per field
+struct PrintBuffer {
+    FILE *file;
+    char buf[PRINT_BUFFER_SIZE];
+    int len;
+
+    PrintBuffer(FILE *_file) {
+        file = _file;
+        len = 0;
+    }
+
+    ~PrintBuffer() { Flush(); }
+
+    void Flush() {
+        if (len) fwrite(buf, 1, len, file);
+        len = 0;
+    }
+
+    void Add(const char *s, int n) {
+        if (n > PRINT_BUFFER_SIZE - len) {
+            Flush();
+            if (n > PRINT_BUFFER_SIZE) {
+                fwrite(s, 1, n, file);
+                return;
+            }
+        }
+        memcpy(&buf[len], s, n);
+        len += n;
+    }
+
+    void Add(const char *s) { Add(s, strlen(s)); }
+
+    void AddInt(int v) {
+        char digits[12];
+        int i = sizeof(digits);
+        unsigned u = v < 0 ? 0u - (unsigned) v : v;
+        do {
+            digits[--i] = '0' + u % 10;
+            u /= 10;
+        } while (u);
+        if (v < 0) digits[--i] = '-';
+        Add(&digits[i], sizeof(digits) - i);
+    }
+};
+
+////////////////////////////////////////////////////////////////////////////////////
+// Identifiers /////////////////////////////////////////////////////////////////////
+
+#define NAME_TABLE_FIRST_SIZE 16 // a power of 2
+
+// Gives every distinct identifier a dense id when it is scanned.
+// The rest of the compiler works with these ids and only needs the names for printing.
+// The ids are found by open addressing with linear probing in slot, which has a power of 2 size and is at most
+// half full. The hash of each name is kept, so probing compares names only when the hashes are equal and
+// growing the table does not hash the names again.
+struct Interner {
+    vector<char> chars; // all names, each followed by a zero byte
+    vector<int> name_start; // offset of the name of each id in chars
+    vector<unsigned> name_hash; // the hash of the name of each id
+    vector<int> slot; // an id, or -1 for an empty slot
+
+    Interner() { slot.assign(NAME_TABLE_FIRST_SIZE, -1); }
+
+    int NumIds() const { return name_start.size(); }
+
+    const char *Name(int id) const { return &chars[name_start[id]]; }
+
+    int NameLen(int id) const {
+        int end = id + 1 < NumIds() ? name_start[id + 1] : chars.size();
+        return end - name_start[id] - 1;
+    }
+
+    int Intern(const char *s, int len) {
+        unsigned h = HashWord(2166136261u, s, len);
+        unsigned mask = slot.size() - 1;
+        unsigned i;
+        int id;
+        for (i = h & mask; (id = slot[i]) >= 0; i = (i + 1) & mask) {
+            if (name_hash[id] == h && NameLen(id) == len && memcmp(Name(id), s, len) == 0) return id;
+        }
+
+        id = NumIds();
+        name_start.push_back(chars.size());
+        chars.insert(chars.end(), s, s + len);
+        chars.push_back(0);
+        name_hash.push_back(h);
+        slot[i] = id;
+        if (2 * NumIds() > (int) slot.size()) Grow();
+        return id;
+    }
+
+    // Doubles the slots and puts the ids back using their kept hashes
+    void Grow() {
+        slot.assign(2 * slot.size(), -1);
+        unsigned mask = slot.size() - 1;
+        int id;
+        for (id = 0; id < NumIds(); id++) {
+            unsigned i;
+            for (i = name_hash[id] & mask; slot[i] >= 0; i = (i + 1) & mask) {}
+            slot[i] = id;
+        }
+    }
+};
+
+////////////////////////////////////////////////////////////////////////////////////
+// Tracing /////////////////////////////////////////////////////////////////////////
+
+// Parser tracing, compiled in only up to level TINY_TRACE (g++ -DTINY_TRACE=2 ...):
+// 0 - none (default), the trace macros expand to nothing and their arguments are never evaluated
+// 1 - parser rules (Start/End of each rule)
+// 2 - also every matched token
+// Events are binary records in a ring buffer that keeps the last TINY_TRACE_EVENTS of them.
+// The buffer is written to debug.txt as text at exit or when compilation fails (see DumpTrace()).
+#ifndef TINY_TRACE
+#define TINY_TRACE 0
+#endif
+
+#ifndef TINY_TRACE_EVENTS
+#define TINY_TRACE_EVENTS (1 << 16) // a power of 2
+#endif
+
+#define TRACE_TEXT_SIZE 16 // token text kept in an event, longer tokens are cut
+
+enum TraceKind {
+    TRACE_MESSAGE, TRACE_TOKEN
+};
+
+struct TraceEvent {
+    unsigned char kind; // TraceKind
+    unsigned char token_type; // TRACE_TOKEN only
+    unsigned short len; // token length (TRACE_TOKEN only), up to TRACE_TEXT_SIZE bytes are in text
+    int line_num;
+    union {
+        const char *message; // a string literal
+        char text[TRACE_TEXT_SIZE];
+    };
+};
+
+struct Tracer {
+    vector<TraceEvent> events; // allocated when the first event comes
+    size_t num_events; // all events so far, the last TINY_TRACE_EVENTS are in events
+
+    Tracer() {
+        num_events = 0;
+    }
+
+    TraceEvent *Add(TraceKind kind) {
+        if (events.empty()) events.resize(TINY_TRACE_EVENTS);
+        TraceEvent *event = &events[num_events++ & (TINY_TRACE_EVENTS - 1)];
+        event->kind = kind;
+        return event;
+    }
+
+    void Message(const char *message) {
+        Add(TRACE_MESSAGE)->message = message;
+    }
+
+    void Token(int line_num, int token_type, const char *text, size_t len) {
+        TraceEvent *event = Add(TRACE_TOKEN);
+        event->token_type = token_type;
+        event->len = len < 0xffff ? len : 0xffff;
+        event->line_num = line_num;
+        memcpy(event->text, text, len < TRACE_TEXT_SIZE ? len : TRACE_TEXT_SIZE);
+    }
+};
+
+#if TINY_TRACE >= 1
+#define TRACE_RULE(pci, message) (pci)->tracer.Message(message)
+#else
+#define TRACE_RULE(pci, message) ((void) (pci)) // pci may be used for nothing else
+#endif
+
+#if TINY_TRACE >= 2
+#define TRACE_TOKEN(pci, line_num, token_type, text, len) (pci)->tracer.Token(line_num, token_type, text, len)
+#else
+#define TRACE_TOKEN(pci, line_num, token_type, text, len) ((void) 0)
+#endif
+
 ////////////////////////////////////////////////////////////////////////////////////
 // Compiler Parameters /////////////////////////////////////////////////////////////
 
@@ -155,17 +553,18 @@ struct CompilerInfo {
     InFile in_file;
     OutFile out_file;
     OutFile debug_file;
+    Interner names;
+    Arena tree_arena; // all TreeNodes, see NewNode()
+    Tracer tracer;
 
-    CompilerInfo(const char *in_str, const char *out_str, const char *debug_str)
-            : in_file(in_str), out_file(out_str), debug_file(debug_str) {
+    CompilerInfo(const char *in_str, const char *out_str, const char *debug_str, bool map_file = true)
+            : in_file(in_str, map_file), out_file(out_str), debug_file(debug_str) {
     }
 };
 
 ////////////////////////////////////////////////////////////////////////////////////
 // Scanner /////////////////////////////////////////////////////////////////////////
 
-#define MAX_TOKEN_LEN 40
-
 enum TokenType {
     IF, THEN, ELSE, END, REPEAT, UNTIL, READ, WRITE,
     ASSIGN, EQUAL, LESS_THAN,
@@ -174,7 +573,8 @@ enum TokenType {
     LEFT_PAREN, RIGHT_PAREN,
     LEFT_BRACE, RIGHT_BRACE,
     ID, NUM,
-    ENDFILE, ERROR
+    ENDFILE, ERROR,
+    SHIFT_LEFT, SHIFT_DIVIDE, MAGIC_DIVIDE, CONST_POWER // operators that ReduceStrength() makes, never scanned
 };
 
 // Used for debugging only /////////////////////////////////////////////////////////
@@ -187,700 +587,1451 @@ const char *TokenTypeStr[] =
                 "LeftParen", "RightParen",
                 "LeftBrace", "RightBrace",
                 "ID", "Num",
-                "EndFile", "Error"
+                "EndFile", "Error",
+                "ShiftLeft", "ShiftDivide", "MagicDivide", "ConstPower"
         };
 
+// A token is 8 bytes: its type, and the offset and length of its text in the source (see InFile::Text).
+// The value of NUM and ID tokens (the number and the identifier id) is kept next to it, see ParseInfo.
 struct Token {
-    TokenType type;
-    char str[MAX_TOKEN_LEN + 1];
+    TokenType type: 8;
+    unsigned len: 24;
+    unsigned pos;
+};
 
-    Token() {
-        str[0] = 0;
-        type = ERROR;
-    }
+static_assert(sizeof(Token) == 8, "Token should stay compact");
+
+// The spelling of a reserved word or symbol
+struct TokenStr {
+    TokenType type;
+    const char *str;
+    int len;
 
-    Token(TokenType _type, const char *_str) {
-        type = _type;
-        Copy(str, _str);
+    constexpr TokenStr(TokenType _type, const char *_str) : type(_type), str(_str), len(0) {
+        while (_str[len]) len++;
     }
 };
 
-const Token reserved_words[] =
+constexpr TokenStr reserved_words[] =
         {
-                Token(IF, "if"),
-                Token(THEN, "then"),
-                Token(ELSE, "else"),
-                Token(END, "end"),
-                Token(REPEAT, "repeat"),
-                Token(UNTIL, "until"),
-                Token(READ, "read"),
-                Token(WRITE, "write")
+                TokenStr(IF, "if"),
+                TokenStr(THEN, "then"),
+                TokenStr(ELSE, "else"),
+                TokenStr(END, "end"),
+                TokenStr(REPEAT, "repeat"),
+                TokenStr(UNTIL, "until"),
+                TokenStr(READ, "read"),
+                TokenStr(WRITE, "write")
         };
 const int num_reserved_words = sizeof(reserved_words) / sizeof(reserved_words[0]);
 
-// if there is tokens like < <=, sort them such that sub-tokens come last: <= <
-// the closing comment should come immediately after opening comment
-const Token symbolic_tokens[] =
-        {
-                Token(ASSIGN, ":="),
-                Token(EQUAL, "="),
-                Token(LESS_THAN, "<"),
-                Token(PLUS, "+"),
-                Token(MINUS, "-"),
-                Token(TIMES, "*"),
-                Token(DIVIDE, "/"),
-                Token(POWER, "^"),
-                Token(SEMI_COLON, ";"),
-                Token(LEFT_PAREN, "("),
-                Token(RIGHT_PAREN, ")"),
-                Token(LEFT_BRACE, "{"),
-                Token(RIGHT_BRACE, "}")
-        };
-const int num_symbolic_tokens = sizeof(symbolic_tokens) / sizeof(symbolic_tokens[0]);
-
-inline bool IsDigit(char ch) { return (ch >= '0' && ch <= '9'); }
-
-inline bool IsLetter(char ch) { return ((ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z')); }
+// Reserved words are recognized through a perfect hash built at compile time: the seed of the hash
+// is searched until every reserved word gets its own slot, so a lookup is one hash and one compare.
 
-inline bool IsLetterOrUnderscore(char ch) { return (IsLetter(ch) || ch == '_'); }
+#define MAX_RESERVED_HASH_BITS 10
 
-void GetNextToken(CompilerInfo *pci, Token *ptoken) {
-    ptoken->type = ERROR;
-    ptoken->str[0] = 0;
+struct ReservedHash {
+    unsigned seed;
+    int bits; // the table has 1<<bits slots
+    int min_len, max_len;
+    signed char slot[1 << MAX_RESERVED_HASH_BITS]; // index in reserved_words or -1
 
-    int i;
-    char *s = pci->in_file.GetNextTokenStr();
-    if (!s) {
-        ptoken->type = ENDFILE;
-        ptoken->str[0] = 0;
-        return;
+    constexpr int Slot(const char *s, int len) const {
+        return HashWord(seed, s, len) >> (32 - bits);
     }
+};
 
-    for (i = 0; i < num_symbolic_tokens; i++) {
-        if (StartsWith(s, symbolic_tokens[i].str))
-            break;
+constexpr ReservedHash MakeReservedHash() {
+    ReservedHash t = {};
+    int i = 0;
+    t.min_len = t.max_len = reserved_words[0].len;
+    for (i = 1; i < num_reserved_words; i++) {
+        if (reserved_words[i].len < t.min_len) t.min_len = reserved_words[i].len;
+        if (reserved_words[i].len > t.max_len) t.max_len = reserved_words[i].len;
     }
 
-    if (i < num_symbolic_tokens) {
-        if (symbolic_tokens[i].type == LEFT_BRACE) {
-            pci->in_file.Advance(strlen(symbolic_tokens[i].str));
-            if (!pci->in_file.SkipUpto(symbolic_tokens[i + 1].str)) return;
-            return GetNextToken(pci, ptoken);
-        }
-        ptoken->type = symbolic_tokens[i].type;
-        Copy(ptoken->str, symbolic_tokens[i].str);
-    } else if (IsDigit(s[0])) {
-        int j = 1;
-        while (IsDigit(s[j])) j++;
-
-        ptoken->type = NUM;
-        Copy(ptoken->str, s, j);
-    } else if (IsLetterOrUnderscore(s[0])) {
-        int j = 1;
-        while (IsLetterOrUnderscore(s[j])) j++;
-
-        ptoken->type = ID;
-        Copy(ptoken->str, s, j);
+    t.bits = 1;
+    while ((1 << t.bits) < num_reserved_words) t.bits++;
 
-        for (i = 0; i < num_reserved_words; i++) {
-            if (Equals(ptoken->str, reserved_words[i].str)) {
-                ptoken->type = reserved_words[i].type;
-                break;
+    for (; t.bits <= MAX_RESERVED_HASH_BITS; t.bits++) {
+        for (t.seed = 2166136261u; t.seed < 2166136261u + 10000; t.seed++) {
+            for (i = 0; i < (1 << t.bits); i++) t.slot[i] = -1;
+            for (i = 0; i < num_reserved_words; i++) {
+                int h = t.Slot(reserved_words[i].str, reserved_words[i].len);
+                if (t.slot[h] >= 0) break;
+                t.slot[h] = i;
             }
+            if (i == num_reserved_words) return t;
         }
     }
+    t.bits = 0;
+    return t;
+}
 
-    int len = strlen(ptoken->str);
-    if (len > 0) pci->in_file.Advance(len);
+constexpr ReservedHash reserved_hash = MakeReservedHash();
+static_assert(reserved_hash.bits > 0, "no perfect hash found for reserved_words");
+
+// Returns the type of the reserved word s, or ID if it is not reserved
+inline TokenType ReservedWordType(const char *s, int len) {
+    if (len < reserved_hash.min_len || len > reserved_hash.max_len) return ID;
+    int i = reserved_hash.slot[reserved_hash.Slot(s, len)];
+    if (i >= 0 && reserved_words[i].len == len && strncmp(s, reserved_words[i].str, len) == 0)
+        return reserved_words[i].type;
+    return ID;
 }
 
-////////////////////////////////////////////////////////////////////////////////////
-// Parser //////////////////////////////////////////////////////////////////////////
+constexpr TokenStr symbolic_tokens[] =
+        {
+                TokenStr(ASSIGN, ":="),
+                TokenStr(EQUAL, "="),
+                TokenStr(LESS_THAN, "<"),
+                TokenStr(PLUS, "+"),
+                TokenStr(MINUS, "-"),
+                TokenStr(TIMES, "*"),
+                TokenStr(DIVIDE, "/"),
+                TokenStr(POWER, "^"),
+                TokenStr(SEMI_COLON, ";"),
+                TokenStr(LEFT_PAREN, "("),
+                TokenStr(RIGHT_PAREN, ")"),
+                TokenStr(LEFT_BRACE, "{"),
+                TokenStr(RIGHT_BRACE, "}")
+        };
+const int num_symbolic_tokens = sizeof(symbolic_tokens) / sizeof(symbolic_tokens[0]);
 
-// program -> stmtseq
-// stmtseq -> stmt { ; stmt }
-// stmt -> ifstmt | repeatstmt | assignstmt | readstmt | writestmt
-// ifstmt -> if exp then stmtseq [ else stmtseq ] end
-// repeatstmt -> repeat stmtseq until expr
-// assignstmt -> identifier := expr
-// readstmt -> read identifier
-// writestmt -> write expr
-// expr -> mathexpr [ (<|=) mathexpr ]
-// mathexpr -> term { (+|-) term }    left associative
-// term -> factor { (*|/) factor }    left associative
-// factor -> newexpr { ^ newexpr }    right associative
-// newexpr -> ( mathexpr ) | number | identifier
+// The scanner is a DFA driven by two tables: every byte is mapped to a character class,
+// and (state, character class) gives the next state. Comments are skipped inside the DFA.
 
-enum NodeKind {
-    IF_NODE, REPEAT_NODE, ASSIGN_NODE, READ_NODE, WRITE_NODE,
-    OPER_NODE, NUM_NODE, ID_NODE
+enum CharClass {
+    SPACE_CHAR, DIGIT_CHAR, LETTER_CHAR, COLON_CHAR, EQUAL_CHAR,
+    OPEN_COMMENT_CHAR, CLOSE_COMMENT_CHAR, SYMBOL_CHAR, ZERO_CHAR, OTHER_CHAR,
+    NUM_CHAR_CLASSES
 };
 
-// Used for debugging only /////////////////////////////////////////////////////////
-const char *NodeKindStr[] =
-        {
-                "If", "Repeat", "Assign", "Read", "Write",
-                "Oper", "Num", "ID"
-        };
+enum State {
+    START, INNUM, INID, INASSIGN, INCOMMENT,
+    DONE, // the token ended before the current character
+    DONE_INCLUDE, // the token ends with the current character
+    FAIL, // the current character can not continue or start a token
+    ZERO, // zero byte: end of the line or of the input, checked by the scanner
+    NUM_SCAN_STATES = DONE
+};
 
-enum ExprDataType {
-    VOID, INTEGER, BOOLEAN
+struct ScanTables {
+    unsigned char char_class[256];
+    unsigned char char_token[256]; // token type of the single character symbols
+    unsigned char next_state[NUM_SCAN_STATES][NUM_CHAR_CLASSES];
 };
 
-// Used for debugging only /////////////////////////////////////////////////////////
-const char *ExprDataTypeStr[] =
-        {
-                "Void", "Integer", "Boolean"
-        };
+constexpr ScanTables MakeScanTables() {
+    ScanTables t = {};
+    int i = 0, j = 0;
+    for (i = 0; i < 256; i++) {
+        t.char_class[i] = OTHER_CHAR;
+        t.char_token[i] = ERROR;
+    }
+    for (i = 0; i < num_symbolic_tokens; i++) {
+        if (symbolic_tokens[i].len != 1) continue;
+        unsigned char ch = symbolic_tokens[i].str[0];
+        t.char_class[ch] = SYMBOL_CHAR;
+        t.char_token[ch] = symbolic_tokens[i].type;
+    }
+    for (i = '0'; i <= '9'; i++) t.char_class[i] = DIGIT_CHAR;
+    for (i = 'a'; i <= 'z'; i++) t.char_class[i] = LETTER_CHAR;
+    for (i = 'A'; i <= 'Z'; i++) t.char_class[i] = LETTER_CHAR;
+    t.char_class['_'] = LETTER_CHAR;
+    t.char_class[' '] = t.char_class['\t'] = t.char_class['\r'] = t.char_class['\n'] = SPACE_CHAR;
+    t.char_class[':'] = COLON_CHAR;
+    t.char_class['='] = EQUAL_CHAR;
+    t.char_class['{'] = OPEN_COMMENT_CHAR;
+    t.char_class['}'] = CLOSE_COMMENT_CHAR;
+    t.char_class[0] = ZERO_CHAR;
+
+    for (j = 0; j < NUM_CHAR_CLASSES; j++) {
+        t.next_state[START][j] = DONE_INCLUDE;
+        t.next_state[INNUM][j] = DONE;
+        t.next_state[INID][j] = DONE;
+        t.next_state[INASSIGN][j] = FAIL;
+        t.next_state[INCOMMENT][j] = INCOMMENT;
+    }
+    t.next_state[START][SPACE_CHAR] = START;
+    t.next_state[START][DIGIT_CHAR] = INNUM;
+    t.next_state[START][LETTER_CHAR] = INID;
+    t.next_state[START][COLON_CHAR] = INASSIGN;
+    t.next_state[START][OPEN_COMMENT_CHAR] = INCOMMENT;
+    t.next_state[START][ZERO_CHAR] = ZERO;
+    t.next_state[START][OTHER_CHAR] = FAIL;
+    t.next_state[INNUM][DIGIT_CHAR] = INNUM;
+    t.next_state[INID][LETTER_CHAR] = INID;
+    t.next_state[INASSIGN][EQUAL_CHAR] = DONE_INCLUDE;
+    t.next_state[INCOMMENT][CLOSE_COMMENT_CHAR] = START;
+    t.next_state[INCOMMENT][ZERO_CHAR] = ZERO;
+    return t;
+}
 
-#define MAX_CHILDREN 3
+constexpr ScanTables scan_tables = MakeScanTables();
+
+// Kernels that skip a whole run of spaces, comment text, digits or letters. Each returns the first byte
+// that does not belong to the run; the zero byte after the text never does. The vector versions may read
+// up to 31 bytes past that byte (see SCAN_PADDING).
+struct ScanKernels {
+    const char *(*skip_spaces)(const char *p);
+    const char *(*skip_comment)(const char *p); // stops at the closing brace
+    const char *(*skip_digits)(const char *p);
+    const char *(*skip_letters)(const char *p);
+    const char *name;
+};
 
-struct TreeNode {
-    TreeNode *child[MAX_CHILDREN];
-    TreeNode *sibling; // used for sibling statements only
+template<int char_class>
+const char *SkipClassScalar(const char *p) {
+    while (scan_tables.char_class[(unsigned char) *p] == char_class) p++;
+    return p;
+}
 
-    NodeKind node_kind;
+const char *SkipCommentScalar(const char *p) {
+    while (*p && *p != '}') p++;
+    return p;
+}
 
-    union {
-        TokenType oper;
-        int num;
-        char *id;
-    }; // defined for expression/int/identifier only
-    ExprDataType expr_data_type; // defined for expression/int/identifier only
+#ifdef TINY_HAVE_SIMD
 
-    int line_num;
+// Sets the bits of the bytes that belong to the run
+struct SpaceMatch {
+    static __m128i Match(__m128i v) {
+        return _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'))),
+                            _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\r')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\n'))));
+    }
 
-    TreeNode() {
-        int i;
-        for (i = 0; i < MAX_CHILDREN; i++) child[i] = 0;
-        sibling = 0;
-        expr_data_type = VOID;
+    __attribute__((target("avx2"))) static __m256i Match(__m256i v) {
+        return _mm256_or_si256(
+                _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t'))),
+                _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n'))));
     }
 };
 
-struct ParseInfo {
-    Token next_token;
+struct CommentMatch { // everything but the closing brace and the zero byte
+    static __m128i Match(__m128i v) {
+        return _mm_xor_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('}')), _mm_cmpeq_epi8(v, _mm_setzero_si128())),
+                             _mm_set1_epi8(-1));
+    }
+
+    __attribute__((target("avx2"))) static __m256i Match(__m256i v) {
+        return _mm256_xor_si256(
+                _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('}')), _mm256_cmpeq_epi8(v, _mm256_setzero_si256())),
+                _mm256_set1_epi8(-1));
+    }
 };
 
-static TreeNode *StmtSeq(CompilerInfo *, ParseInfo *);
+struct DigitMatch { // bytes >= 128 are negative and fail the signed compares
+    static __m128i Match(__m128i v) {
+        return _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)), _mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1)));
+    }
 
-static TreeNode *Stmt(CompilerInfo *pci, ParseInfo *ppi);
+    __attribute__((target("avx2"))) static __m256i Match(__m256i v) {
+        return _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('0' - 1)),
+                                _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), v));
+    }
+};
 
-static TreeNode *IfStmt(CompilerInfo *pci, ParseInfo *ppi);
+struct LetterMatch { // setting bit 5 folds upper case letters to lower case and maps no other byte into a-z
+    static __m128i Match(__m128i v) {
+        __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+        return _mm_or_si128(
+                _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)), _mm_cmplt_epi8(lower, _mm_set1_epi8('z' + 1))),
+                _mm_cmpeq_epi8(v, _mm_set1_epi8('_')));
+    }
 
-static TreeNode *RepeatStmt(CompilerInfo *pci, ParseInfo *ppi);
+    __attribute__((target("avx2"))) static __m256i Match(__m256i v) {
+        __m256i lower = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+        return _mm256_or_si256(_mm256_and_si256(_mm256_cmpgt_epi8(lower, _mm256_set1_epi8('a' - 1)),
+                                                _mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), lower)),
+                               _mm256_cmpeq_epi8(v, _mm256_set1_epi8('_')));
+    }
+};
 
-static TreeNode *AssignStmt(CompilerInfo *pci, ParseInfo *ppi);
+template<class M>
+const char *SkipSSE2(const char *p) {
+    while (true) {
+        unsigned mask = ~_mm_movemask_epi8(M::Match(_mm_loadu_si128((const __m128i *) p))) & 0xFFFF;
+        if (mask) return p + __builtin_ctz(mask);
+        p += 16;
+    }
+}
 
-static TreeNode *ReadStmt(CompilerInfo *pci, ParseInfo *ppi);
+template<class M>
+__attribute__((target("avx2"))) const char *SkipAVX2(const char *p) {
+    while (true) {
+        unsigned mask = ~(unsigned) _mm256_movemask_epi8(M::Match(_mm256_loadu_si256((const __m256i *) p)));
+        if (mask) return p + __builtin_ctz(mask);
+        p += 32;
+    }
+}
 
-static TreeNode *WriteStmt(CompilerInfo *pci, ParseInfo *ppi);
+#endif
+
+// The fastest kernels that the CPU runs. The environment variable TINY_SCAN_KERNEL=scalar, sse2 or avx2 picks
+// slower ones instead, to compare them (bench/scan.sh).
+ScanKernels SelectScanKernels() {
+    const char *forced = getenv("TINY_SCAN_KERNEL");
+    if (!forced) forced = "";
+#ifdef TINY_HAVE_SIMD
+    if (__builtin_cpu_supports("avx2") && !Equals(forced, "sse2") && !Equals(forced, "scalar"))
+        return {SkipAVX2<SpaceMatch>, SkipAVX2<CommentMatch>, SkipAVX2<DigitMatch>, SkipAVX2<LetterMatch>, "avx2"};
+    if (!Equals(forced, "scalar"))
+        return {SkipSSE2<SpaceMatch>, SkipSSE2<CommentMatch>, SkipSSE2<DigitMatch>, SkipSSE2<LetterMatch>, "sse2"};
+#endif
+    return {SkipClassScalar<SPACE_CHAR>, SkipCommentScalar, SkipClassScalar<DIGIT_CHAR>, SkipClassScalar<LETTER_CHAR>,
+            "scalar"};
+}
 
-static TreeNode *Expr(CompilerInfo *pci, ParseInfo *ppi);
+const ScanKernels scan_kernels = SelectScanKernels();
 
-static TreeNode *MathExpr(CompilerInfo *, ParseInfo *);
+// Runs between tokens are mostly short, a kernel call only pays off once the first few bytes are skipped
+template<int char_class>
+inline const char *SkipRun(const char *p, const char *(*kernel)(const char *)) {
+    for (int i = 0; i < 8; i++, p++)
+        if (scan_tables.char_class[(unsigned char) *p] != char_class) return p;
+    return kernel(p);
+}
 
-static TreeNode *Term(CompilerInfo *pci, ParseInfo *ppi);
+// Runs the scanner DFA from *pp in state *pstate (START or INCOMMENT) and returns
+// - DONE when a token is complete: it is [*ps, *pp), *pstate is the state it ended in (START for symbols)
+// - FAIL when the text can not continue or start a token: *ps is where the offending token starts
+// - ZERO at a zero byte or at limit, between tokens or in a comment (*pstate tells which): *pp points at it,
+//   *ps at the start of the comment if it started in this call
+// limit is only checked with check_limit, otherwise the zero byte at limit has to stop the scanner.
+template<bool check_limit>
+inline int RunScanner(const char **pp, const char **ps, int *pstate, const char *limit) {
+    const char *p = *pp;
+    const char *s = p;
+    int state = *pstate;
+
+    while (true) {
+        unsigned char ch = *p;
+        int next = scan_tables.next_state[state][scan_tables.char_class[ch]];
+
+        if (next < NUM_SCAN_STATES) {
+            if (state == START) s = p; // skipped a space or a comment, the token starts later
+            state = next;
+            p++;
+
+            // the rest of a run is skipped by a kernel, the DFA only sees the byte that ends it
+            if (state == START) {
+                p = SkipRun<SPACE_CHAR>(p, scan_kernels.skip_spaces);
+                if (check_limit && p >= limit) break;
+            } else if (state == INID) p = SkipRun<LETTER_CHAR>(p, scan_kernels.skip_letters);
+            else if (state == INNUM) p = SkipRun<DIGIT_CHAR>(p, scan_kernels.skip_digits);
+            else if (state == INCOMMENT) {
+                p = scan_kernels.skip_comment(p);
+                if (check_limit && p >= limit) break;
+            }
+            continue;
+        }
 
-static TreeNode *Factor(CompilerInfo *pci, ParseInfo *ppi);
+        if (state == START) s = p;
+        *ps = s;
+        *pstate = state;
+        if (next == FAIL) {
+            *pp = s;
+            return FAIL;
+        }
+        if (next == ZERO) {
+            *pp = p;
+            return ZERO;
+        }
+        if (next == DONE_INCLUDE) p++;
+        *pp = p;
+        return DONE;
+    }
 
-static TreeNode *NewExpr(CompilerInfo *pci, ParseInfo *ppi);
+    *pp = limit;
+    *ps = s;
+    *pstate = state;
+    return ZERO;
+}
 
+// Sets the type of the token [s, s + len) that the DFA completed in state, and its value (see GetNextToken)
+inline void SetTokenType(Interner *names, int state, const char *s, int len, Token *ptoken, int *pvalue) {
+    ptoken->len = len;
+    if (state == START) ptoken->type = (TokenType) scan_tables.char_token[(unsigned char) s[0]];
+    else if (state == INASSIGN) ptoken->type = ASSIGN;
+    else if (state == INNUM) {
+        ptoken->type = NUM;
+        unsigned num = 0;
+        for (int i = 0; i < len; i++) num = num * 10 + (s[i] - '0');
+        *pvalue = num;
+    } else {
+        ptoken->type = ReservedWordType(s, len);
+        if (ptoken->type == ID) *pvalue = names->Intern(s, len);
+    }
+}
 
-void Match(CompilerInfo *pci, ParseInfo *ppi, TokenType expected_token_type) {
-    pci->debug_file.Out("Start Match");
+// Scans the next token, *pvalue gets the number of NUM tokens and the identifier id of ID tokens
+void GetNextToken(CompilerInfo *pci, Token *ptoken, int *pvalue) {
+    InFile *in = &pci->in_file;
+    ptoken->type = ERROR;
+    ptoken->len = 0;
+    *pvalue = 0;
 
-    if (ppi->next_token.type != expected_token_type) throw 0;
-    GetNextToken(pci, &ppi->next_token);
+    const char *p = in->Cur();
+    const char *s = p;
+    int state = START;
 
-    fprintf(pci->debug_file.file, "[%d] %s (%s)\n", pci->in_file.cur_line_num, ppi->next_token.str,
-            TokenTypeStr[ppi->next_token.type]);
-    fflush(pci->debug_file.file);
-}
+    while (true) {
+        int result = RunScanner<false>(&p, &s, &state, in->Limit());
 
-// stmtseq -> stmt { ; stmt }
-TreeNode *StmtSeq(CompilerInfo *pci, ParseInfo *ppi) {
-    pci->debug_file.Out("Start StmtSeq");
+        if (result == ZERO) {
+            if (in->AtEnd(p)) {
+                if (in->NextLine()) {
+                    p = in->Cur();
+                    continue;
+                }
+                // end of input, inside a comment it is an error
+                in->Seek(p);
+                ptoken->pos = in->EndPos();
+                if (state == START) ptoken->type = ENDFILE;
+                return;
+            }
+            result = FAIL; // zero byte inside the text
+        }
 
-    TreeNode *first_tree = Stmt(pci, ppi);
-    TreeNode *last_tree = first_tree;
+        ptoken->pos = in->Offset(s);
+        if (result == FAIL) {
+            // the offending text is left unread
+            in->Seek(s);
+            return;
+        }
 
-    // If we did not reach one of the Follow() of StmtSeq(), we are not done yet
-    while (ppi->next_token.type != ENDFILE && ppi->next_token.type != END &&
-           ppi->next_token.type != ELSE && ppi->next_token.type != UNTIL) {
-        Match(pci, ppi, SEMI_COLON);
-        TreeNode *next_tree = Stmt(pci, ppi);
-        last_tree->sibling = next_tree;
-        last_tree = next_tree;
+        in->Seek(p);
+        SetTokenType(&pci->names, state, s, p - s, ptoken, pvalue);
+        return;
     }
+}
+
+// All tokens of the source, scanned before parsing starts. The last token is ENDFILE or ERROR.
+struct TokenArray {
+    vector<Token> tokens;
+    vector<int> values; // see GetNextToken()
+};
 
-    pci->debug_file.Out("End StmtSeq");
-    return first_tree;
+void ScanAll(CompilerInfo *pci, TokenArray *pta) {
+    // real sources have well under one token per two bytes, reserving that much
+    // avoids copying the arrays while they grow (untouched capacity costs no memory)
+    size_t expected = pci->in_file.map_len / 2 + 1;
+    pta->tokens.reserve(expected);
+    pta->values.reserve(expected);
+
+    Token token;
+    int value;
+    do {
+        GetNextToken(pci, &token, &value);
+        pta->tokens.push_back(token);
+        pta->values.push_back(value);
+    } while (token.type != ENDFILE && token.type != ERROR);
 }
 
-// stmt -> ifstmt | repeatstmt | assignstmt | readstmt | writestmt
-TreeNode *Stmt(CompilerInfo *pci, ParseInfo *ppi) {
-    pci->debug_file.Out("Start Stmt");
+#ifdef TINY_HAVE_MMAP
 
-    // Compare the next token with the First() of possible statements
-    TreeNode *tree = 0;
-    if (ppi->next_token.type == IF) tree = IfStmt(pci, ppi);
-    else if (ppi->next_token.type == REPEAT) tree = RepeatStmt(pci, ppi);
-    else if (ppi->next_token.type == ID) tree = AssignStmt(pci, ppi);
-    else if (ppi->next_token.type == READ) tree = ReadStmt(pci, ppi);
-    else if (ppi->next_token.type == WRITE) tree = WriteStmt(pci, ppi);
-    else throw 0;
+// Parallel scanning: the mapped source is split at line ends into chunks that are scanned on a pool of
+// threads. No token spans a line end but comments do, so every chunk is scanned both as if it starts outside
+// a comment and as if it starts inside one. Once the state at the start of each chunk is known, the matching
+// scans are joined. The result is exactly what ScanAll() gives.
 
-    pci->debug_file.Out("End Stmt");
-    return tree;
-}
+#define MIN_SCAN_CHUNK (1 << 20)
+#define SCAN_CHUNKS_PER_THREAD 4
 
-// ifstmt -> if exp then stmtseq [ else stmtseq ] end
-TreeNode *IfStmt(CompilerInfo *pci, ParseInfo *ppi) {
-    pci->debug_file.Out("Start IfStmt");
+const size_t NO_OFFSET = (size_t) -1;
 
-    TreeNode *tree = new TreeNode;
-    tree->node_kind = IF_NODE;
-    tree->line_num = pci->in_file.cur_line_num;
+struct ScannedChunk {
+    size_t begin, end; // offsets of the chunk in the source
+    vector<Token> tokens;
+    vector<int> values; // identifiers have their ids in names
+    Interner names;
+    bool in_comment; // the chunk ends inside a comment
+    size_t open_comment; // the start of that comment, NO_OFFSET if it started before the chunk
+    bool failed; // the last token is an ERROR
+    bool failed_in_open_comment; // ... inside a comment that started before the chunk
+    size_t joined_at; // the tokens from this index of the outside scan follow, NO_OFFSET if none
+};
 
-    Match(pci, ppi, IF);
-    tree->child[0] = Expr(pci, ppi);
-    Match(pci, ppi, THEN);
-    tree->child[1] = StmtSeq(pci, ppi);
-    if (ppi->next_token.type == ELSE) {
-        Match(pci, ppi, ELSE);
-        tree->child[2] = StmtSeq(pci, ppi);
+// Scans a chunk as if it starts outside a comment, or inside one if outside (the scan of the chunk from outside
+// a comment) is given. The second scan stops at the first token that outside also has, from there on both are
+// the same.
+void ScanChunk(const char *text, size_t text_len, const ScannedChunk *outside, ScannedChunk *pc) {
+    const char *p = &text[pc->begin];
+    const char *limit = &text[pc->end];
+    const char *s;
+    int state = START;
+    size_t j = 0;
+
+    pc->in_comment = pc->failed = pc->failed_in_open_comment = false;
+    pc->open_comment = pc->joined_at = NO_OFFSET;
+
+    if (outside) {
+        // the comment that started before the chunk ends at the first '}'
+        const char *close = (const char *) memchr(p, '}', limit - p);
+        const char *zero = (const char *) memchr(p, 0, (close ? close : limit) - p);
+        if (zero) {
+            // zero byte in the comment, the merge sets the position of the error
+            Token token;
+            token.type = ERROR;
+            token.len = 0;
+            token.pos = 0;
+            pc->tokens.push_back(token);
+            pc->values.push_back(0);
+            pc->failed = pc->failed_in_open_comment = true;
+            return;
+        }
+        if (!close) {
+            pc->in_comment = true;
+            return;
+        }
+        p = close + 1;
     }
-    Match(pci, ppi, END);
 
-    pci->debug_file.Out("End IfStmt");
-    return tree;
-}
+    while (true) {
+        int result = RunScanner<true>(&p, &s, &state, limit);
 
-// repeatstmt -> repeat stmtseq until expr
-TreeNode *RepeatStmt(CompilerInfo *pci, ParseInfo *ppi) {
-    pci->debug_file.Out("Start RepeatStmt");
+        if (result == ZERO) {
+            if (p >= limit || p == &text[text_len]) break;
+            result = FAIL; // zero byte inside the text
+        }
 
-    TreeNode *tree = new TreeNode;
-    tree->node_kind = REPEAT_NODE;
-    tree->line_num = pci->in_file.cur_line_num;
+        Token token;
+        int value = 0;
+        token.pos = s - text;
 
-    Match(pci, ppi, REPEAT);
-    tree->child[0] = StmtSeq(pci, ppi);
-    Match(pci, ppi, UNTIL);
-    tree->child[1] = Expr(pci, ppi);
-
-    pci->debug_file.Out("End RepeatStmt");
-    return tree;
-}
-
-// assignstmt -> identifier := expr
-TreeNode *AssignStmt(CompilerInfo *pci, ParseInfo *ppi) {
-    pci->debug_file.Out("Start AssignStmt");
+        if (outside) {
+            while (j < outside->tokens.size() && outside->tokens[j].pos < token.pos) j++;
+            if (j < outside->tokens.size() && outside->tokens[j].pos == token.pos) {
+                pc->joined_at = j;
+                return;
+            }
+        }
 
-    TreeNode *tree = new TreeNode;
-    tree->node_kind = ASSIGN_NODE;
-    tree->line_num = pci->in_file.cur_line_num;
+        if (result == FAIL) {
+            token.type = ERROR;
+            token.len = 0;
+            pc->tokens.push_back(token);
+            pc->values.push_back(value);
+            pc->failed = true;
+            return;
+        }
 
-    if (ppi->next_token.type == ID) AllocateAndCopy(&tree->id, ppi->next_token.str);
-    Match(pci, ppi, ID);
-    Match(pci, ppi, ASSIGN);
-    tree->child[0] = Expr(pci, ppi);
+        SetTokenType(&pc->names, state, s, p - s, &token, &value);
+        pc->tokens.push_back(token);
+        pc->values.push_back(value);
+        state = START;
+    }
 
-    pci->debug_file.Out("End AssignStmt");
-    return tree;
+    if (state == INCOMMENT) {
+        pc->in_comment = true;
+        pc->open_comment = s - text;
+    }
 }
 
-// readstmt -> read identifier
-TreeNode *ReadStmt(CompilerInfo *pci, ParseInfo *ppi) {
-    pci->debug_file.Out("Start ReadStmt");
-
-    TreeNode *tree = new TreeNode;
-    tree->node_kind = READ_NODE;
-    tree->line_num = pci->in_file.cur_line_num;
+struct ScanJob {
+    const char *text;
+    size_t text_len;
+    vector<ScannedChunk> outside, inside;
+    atomic<int> next_chunk;
+};
 
-    Match(pci, ppi, READ);
-    if (ppi->next_token.type == ID) AllocateAndCopy(&tree->id, ppi->next_token.str);
-    Match(pci, ppi, ID);
+void ScanChunks(ScanJob *job) {
+    int i;
+    while ((i = job->next_chunk++) < (int) job->outside.size()) {
+        ScanChunk(job->text, job->text_len, 0, &job->outside[i]);
+        if (i > 0) ScanChunk(job->text, job->text_len, &job->outside[i], &job->inside[i]);
+    }
+}
 
-    pci->debug_file.Out("End ReadStmt");
-    return tree;
+// Appends tokens [from, to) of a chunk, replacing the chunk's identifier ids by those of names
+void AppendChunkTokens(Interner *names, const ScannedChunk *pc, size_t from, size_t to, TokenArray *pta) {
+    size_t start = pta->tokens.size();
+    pta->tokens.insert(pta->tokens.end(), pc->tokens.begin() + from, pc->tokens.begin() + to);
+    pta->values.insert(pta->values.end(), pc->values.begin() + from, pc->values.begin() + to);
+
+    vector<int> ids(pc->names.NumIds(), -1);
+    size_t i;
+    for (i = start; i < pta->tokens.size(); i++) {
+        if (pta->tokens[i].type != ID) continue;
+        int &id = ids[pta->values[i]];
+        if (id < 0) {
+            const char *name = pc->names.Name(pta->values[i]);
+            id = names->Intern(name, strlen(name));
+        }
+        pta->values[i] = id;
+    }
 }
 
-// writestmt -> write expr
-TreeNode *WriteStmt(CompilerInfo *pci, ParseInfo *ppi) {
-    pci->debug_file.Out("Start WriteStmt");
+// Like ScanAll(), on num_threads threads. Small or unmapped sources are scanned by ScanAll().
+void ScanAllParallel(CompilerInfo *pci, TokenArray *pta, int num_threads) {
+    InFile *in = &pci->in_file;
+    if (!in->map_buf || num_threads <= 1 || in->map_len < 2 * MIN_SCAN_CHUNK) {
+        ScanAll(pci, pta);
+        return;
+    }
 
-    TreeNode *tree = new TreeNode;
-    tree->node_kind = WRITE_NODE;
-    tree->line_num = pci->in_file.cur_line_num;
+    ScanJob job;
+    job.text = in->map_buf;
+    job.text_len = in->map_len;
+    job.next_chunk = 0;
+
+    size_t num_chunks = num_threads * SCAN_CHUNKS_PER_THREAD;
+    if (num_chunks > in->map_len / MIN_SCAN_CHUNK) num_chunks = in->map_len / MIN_SCAN_CHUNK;
+
+    size_t i, begin = 0;
+    for (i = 1; i <= num_chunks && begin < in->map_len; i++) {
+        size_t end = in->map_len;
+        if (i < num_chunks && in->map_len * i / num_chunks > begin) {
+            const char *nl = (const char *) memchr(&in->map_buf[in->map_len * i / num_chunks], '\n',
+                                                   in->map_len - in->map_len * i / num_chunks);
+            if (nl) end = nl - in->map_buf + 1;
+        }
+        if (end <= begin) continue;
+        job.outside.emplace_back();
+        job.outside.back().begin = begin;
+        job.outside.back().end = end;
+        begin = end;
+    }
+    job.inside.resize(job.outside.size());
+    for (i = 0; i < job.outside.size(); i++) {
+        job.inside[i].begin = job.outside[i].begin;
+        job.inside[i].end = job.outside[i].end;
+    }
 
-    Match(pci, ppi, WRITE);
-    tree->child[0] = Expr(pci, ppi);
+    vector<thread> threads;
+    int t;
+    for (t = 1; t < num_threads; t++) threads.emplace_back(ScanChunks, &job);
+    ScanChunks(&job);
+    for (t = 0; t < (int) threads.size(); t++) threads[t].join();
+
+    size_t num_tokens = 1;
+    for (i = 0; i < job.outside.size(); i++) num_tokens += job.outside[i].tokens.size();
+    pta->tokens.reserve(num_tokens);
+    pta->values.reserve(num_tokens);
+
+    // join the chunk scans that start in the right state
+    bool in_comment = false;
+    size_t open_comment = 0;
+    for (i = 0; i < job.outside.size(); i++) {
+        const ScannedChunk *pc = in_comment ? &job.inside[i] : &job.outside[i];
+        AppendChunkTokens(&pci->names, pc, 0, pc->tokens.size(), pta);
+        if (pc->failed_in_open_comment) pta->tokens.back().pos = open_comment;
+
+        if (pc->joined_at != NO_OFFSET) {
+            size_t joined_at = pc->joined_at;
+            pc = &job.outside[i];
+            AppendChunkTokens(&pci->names, pc, joined_at, pc->tokens.size(), pta);
+        }
+        if (pc->failed) break;
 
-    pci->debug_file.Out("End WriteStmt");
-    return tree;
+        in_comment = pc->in_comment;
+        if (in_comment && pc->open_comment != NO_OFFSET) open_comment = pc->open_comment;
+    }
+
+    if (pta->tokens.empty() || pta->tokens.back().type != ERROR) {
+        // end of input, inside a comment it is an error
+        Token token;
+        token.type = in_comment ? ERROR : ENDFILE;
+        token.len = 0;
+        token.pos = in->EndPos();
+        pta->tokens.push_back(token);
+        pta->values.push_back(0);
+    }
+    in->Seek(in->Limit());
 }
 
-// expr -> mathexpr [ (<|=) mathexpr ]
-TreeNode *Expr(CompilerInfo *pci, ParseInfo *ppi) {
-    pci->debug_file.Out("Start Expr");
+#else
 
-    TreeNode *tree = MathExpr(pci, ppi);
+void ScanAllParallel(CompilerInfo *pci, TokenArray *pta, int) {
+    ScanAll(pci, pta);
+}
 
-    if (ppi->next_token.type == EQUAL || ppi->next_token.type == LESS_THAN) {
-        TreeNode *new_tree = new TreeNode;
-        new_tree->node_kind = OPER_NODE;
-        new_tree->oper = ppi->next_token.type;
-        new_tree->line_num = pci->in_file.cur_line_num;
+#endif
 
-        new_tree->child[0] = tree;
-        Match(pci, ppi, ppi->next_token.type);
-        new_tree->child[1] = MathExpr(pci, ppi);
+// Writes the trace to the debug file, oldest event first
+void DumpTrace(CompilerInfo *pci) {
+    Tracer *tracer = &pci->tracer;
+    FILE *file = pci->debug_file.file;
+    if (!file || tracer->num_events == 0) return;
 
-        pci->debug_file.Out("End Expr");
-        return new_tree;
+    size_t i = 0;
+    if (tracer->num_events > TINY_TRACE_EVENTS) {
+        i = tracer->num_events - TINY_TRACE_EVENTS;
+        fprintf(file, "(%zu earlier events dropped)\n", i);
     }
-    pci->debug_file.Out("End Expr");
-    return tree;
+    for (; i < tracer->num_events; i++) {
+        const TraceEvent *event = &tracer->events[i & (TINY_TRACE_EVENTS - 1)];
+        if (event->kind == TRACE_MESSAGE) fprintf(file, "%s\n", event->message);
+        else {
+            int len = event->len < TRACE_TEXT_SIZE ? event->len : TRACE_TEXT_SIZE;
+            fprintf(file, "[%d] %.*s%s (%s)\n", event->line_num, len, event->text,
+                    event->len > TRACE_TEXT_SIZE ? "..." : "", TokenTypeStr[event->token_type]);
+        }
+    }
+    fflush(file);
 }
 
+////////////////////////////////////////////////////////////////////////////////////
+// Parser //////////////////////////////////////////////////////////////////////////
+
+// program -> stmtseq
+// stmtseq -> stmt { ; stmt }
+// stmt -> ifstmt | repeatstmt | assignstmt | readstmt | writestmt
+// ifstmt -> if exp then stmtseq [ else stmtseq ] end
+// repeatstmt -> repeat stmtseq until expr
+// assignstmt -> identifier := expr
+// readstmt -> read identifier
+// writestmt -> write expr
+// expr -> mathexpr [ (<|=) mathexpr ]
 // mathexpr -> term { (+|-) term }    left associative
-TreeNode *MathExpr(CompilerInfo *pci, ParseInfo *ppi) {
-    pci->debug_file.Out("Start MathExpr");
+// term -> factor { (*|/) factor }    left associative
+// factor -> newexpr { ^ newexpr }    right associative
+// newexpr -> ( mathexpr ) | number | identifier
+// expr, mathexpr, term and factor are parsed by one precedence climbing routine, see oper_table
 
-    TreeNode *tree = Term(pci, ppi);
+enum NodeKind {
+    IF_NODE, REPEAT_NODE, ASSIGN_NODE, READ_NODE, WRITE_NODE,
+    OPER_NODE, NUM_NODE, ID_NODE
+};
 
-    while (ppi->next_token.type == PLUS || ppi->next_token.type == MINUS) {
-        TreeNode *new_tree = new TreeNode;
-        new_tree->node_kind = OPER_NODE;
-        new_tree->oper = ppi->next_token.type;
-        new_tree->line_num = pci->in_file.cur_line_num;
+// Used for debugging only /////////////////////////////////////////////////////////
+const char *NodeKindStr[] =
+        {
+                "If", "Repeat", "Assign", "Read", "Write",
+                "Oper", "Num", "ID"
+        };
 
-        new_tree->child[0] = tree;
-        Match(pci, ppi, ppi->next_token.type);
-        new_tree->child[1] = Term(pci, ppi);
+enum ExprDataType {
+    VOID, INTEGER, BOOLEAN
+};
 
-        tree = new_tree;
-    }
-    pci->debug_file.Out("End MathExpr");
-    return tree;
-}
+// Used for debugging only /////////////////////////////////////////////////////////
+const char *ExprDataTypeStr[] =
+        {
+                "Void", "Integer", "Boolean"
+        };
 
-// term -> factor { (*|/) factor }    left associative
-TreeNode *Term(CompilerInfo *pci, ParseInfo *ppi) {
-    pci->debug_file.Out("Start Term");
+#define MAX_CHILDREN 3
 
-    TreeNode *tree = Factor(pci, ppi);
+struct VariableInfo;
+
+struct TreeNode {
+    TreeNode *child[MAX_CHILDREN];
+    TreeNode *sibling; // used for sibling statements only
 
-    while (ppi->next_token.type == TIMES || ppi->next_token.type == DIVIDE) {
-        TreeNode *new_tree = new TreeNode;
-        new_tree->node_kind = OPER_NODE;
-        new_tree->oper = ppi->next_token.type;
-        new_tree->line_num = pci->in_file.cur_line_num;
+    NodeKind node_kind;
 
-        new_tree->child[0] = tree;
-        Match(pci, ppi, ppi->next_token.type);
-        new_tree->child[1] = Factor(pci, ppi);
+    union {
+        TokenType oper;
+        int num;
+        int id; // see Interner
+    }; // defined for expression/int/identifier only
+    ExprDataType expr_data_type; // defined for expression/int/identifier only
+
+    int line_num;
+
+    // set by Analyze() for identifier/read/assign nodes
+    VariableInfo *var; // memloc is the slot of the variable
+    bool first_use; // the node is on the first line of its variable, where the generated code declares it
 
-        tree = new_tree;
+    TreeNode() {
+        int i;
+        for (i = 0; i < MAX_CHILDREN; i++) child[i] = 0;
+        sibling = 0;
+        expr_data_type = VOID;
+        var = 0;
+        first_use = false;
     }
-    pci->debug_file.Out("End Term");
-    return tree;
+};
+
+// Tree nodes live in the arena of the compilation, a whole tree is freed at once by DestroyTrees()
+TreeNode *NewNode(CompilerInfo *pci) {
+    return new(pci->tree_arena.Allocate(sizeof(TreeNode))) TreeNode;
 }
 
-// factor -> newexpr { ^ newexpr }    right associative
-TreeNode *Factor(CompilerInfo *pci, ParseInfo *ppi) {
-    pci->debug_file.Out("Start Factor");
+// An expression that is being parsed, what a call of Expr() was before it became a loop (see Expr())
+struct ExprFrame {
+    TreeNode *tree; // the expression so far, 0 before its first operand
+    TreeNode *last_right; // the last right associative operator, its right child is the last operand
+    TreeNode *oper; // the operator whose right operand is being parsed, 0 if none
+    int min_precedence;
+    bool paren; // the mathexpr of ( mathexpr ), a ) follows it
+};
 
-    TreeNode *tree = NewExpr(pci, ppi);
+struct ParseInfo {
+    Token next_token;
+    int next_value; // see GetNextToken()
 
-    if (ppi->next_token.type == POWER) {
-        TreeNode *new_tree = new TreeNode;
-        new_tree->node_kind = OPER_NODE;
-        new_tree->oper = ppi->next_token.type;
-        new_tree->line_num = pci->in_file.cur_line_num;
+    const TokenArray *tokens; // pre-scanned tokens, 0 to scan while parsing
+    size_t next_index; // the index in tokens after next_token
 
-        new_tree->child[0] = tree;
-        Match(pci, ppi, ppi->next_token.type);
-        new_tree->child[1] = Factor(pci, ppi);
+    vector<ExprFrame> expr_stack; // see Expr()
 
-        pci->debug_file.Out("End Factor");
-        return new_tree;
+    ParseInfo() {
+        next_value = 0;
+        tokens = 0;
+        next_index = 0;
     }
-    pci->debug_file.Out("End Factor");
-    return tree;
-}
+};
 
-// newexpr -> ( mathexpr ) | number | identifier
-TreeNode *NewExpr(CompilerInfo *pci, ParseInfo *ppi) {
-    pci->debug_file.Out("Start NewExpr");
+// Handles a finished top-level statement, see StmtSeq()
+typedef void (*StmtHandler)(TreeNode *stmt, void *data);
 
-    // Compare the next token with the First() of possible statements
-    if (ppi->next_token.type == NUM) {
-        TreeNode *tree = new TreeNode;
-        tree->node_kind = NUM_NODE;
-        char *num_str = ppi->next_token.str;
-        tree->num = 0;
-        while (*num_str) tree->num = tree->num * 10 + ((*num_str++) - '0');
-        tree->line_num = pci->in_file.cur_line_num;
-        Match(pci, ppi, ppi->next_token.type);
+// A statement sequence that is being parsed
+struct StmtSeqFrame {
+    TreeNode *first_tree, *last_tree; // the statements parsed so far
+    TreeNode *owner; // the if/repeat statement that the sequence is part of, 0 for the program
+    int child; // the child of owner that the sequence becomes
+};
 
-        pci->debug_file.Out("End NewExpr");
-        return tree;
-    }
+static TreeNode *StmtSeq(CompilerInfo *, ParseInfo *, StmtHandler handler = 0, void *data = 0);
 
-    if (ppi->next_token.type == ID) {
-        TreeNode *tree = new TreeNode;
-        tree->node_kind = ID_NODE;
-        AllocateAndCopy(&tree->id, ppi->next_token.str);
-        tree->line_num = pci->in_file.cur_line_num;
-        Match(pci, ppi, ppi->next_token.type);
+static TreeNode *Stmt(CompilerInfo *pci, ParseInfo *ppi, vector<StmtSeqFrame> *stack);
 
-        pci->debug_file.Out("End NewExpr");
-        return tree;
-    }
+static TreeNode *IfStmt(CompilerInfo *pci, ParseInfo *ppi, vector<StmtSeqFrame> *stack);
 
-    if (ppi->next_token.type == LEFT_PAREN) {
-        Match(pci, ppi, LEFT_PAREN);
-        TreeNode *tree = MathExpr(pci, ppi);
-        Match(pci, ppi, RIGHT_PAREN);
+static TreeNode *RepeatStmt(CompilerInfo *pci, ParseInfo *ppi, vector<StmtSeqFrame> *stack);
 
-        pci->debug_file.Out("End NewExpr");
-        return tree;
-    }
+static TreeNode *EndCompoundStmt(CompilerInfo *pci, ParseInfo *ppi, vector<StmtSeqFrame> *stack,
+                                 const StmtSeqFrame *seq);
 
-    throw 0;
-    return 0;
-}
+static TreeNode *AssignStmt(CompilerInfo *pci, ParseInfo *ppi);
 
+static TreeNode *ReadStmt(CompilerInfo *pci, ParseInfo *ppi);
 
-// program -> stmtseq
-TreeNode *Parse(CompilerInfo *pci) {
-    ParseInfo parse_info;
-    GetNextToken(pci, &parse_info.next_token);
+static TreeNode *WriteStmt(CompilerInfo *pci, ParseInfo *ppi);
 
-    TreeNode *syntax_tree = StmtSeq(pci, &parse_info);
+// Binary operators, higher precedence binds tighter
+enum OperPrecedence {
+    NO_PRECEDENCE, // not a binary operator
+    COMPARE_PRECEDENCE, // expr
+    ADD_PRECEDENCE, // mathexpr
+    MULTIPLY_PRECEDENCE, // term
+    POWER_PRECEDENCE // factor
+};
 
-    if (parse_info.next_token.type != ENDFILE)
-        pci->debug_file.Out("Error code ends before file ends");
+enum OperAssociativity {
+    LEFT_ASSOC, RIGHT_ASSOC, NON_ASSOC
+};
 
-    return syntax_tree;
+struct OperInfo {
+    unsigned char precedence; // OperPrecedence
+    unsigned char assoc; // OperAssociativity
+};
+
+struct OperTable {
+    OperInfo info[ERROR + 1]; // by TokenType
+};
+
+constexpr OperTable MakeOperTable() {
+    OperTable t = {};
+    t.info[EQUAL] = t.info[LESS_THAN] = {COMPARE_PRECEDENCE, NON_ASSOC};
+    t.info[PLUS] = t.info[MINUS] = {ADD_PRECEDENCE, LEFT_ASSOC};
+    t.info[TIMES] = t.info[DIVIDE] = {MULTIPLY_PRECEDENCE, LEFT_ASSOC};
+    t.info[POWER] = {POWER_PRECEDENCE, RIGHT_ASSOC};
+    return t;
 }
 
-void PrintTree(TreeNode *node, int sh = 0) {
-    int i, NSH = 3;
-    for (i = 0; i < sh; i++) printf(" ");
+constexpr OperTable oper_table = MakeOperTable();
 
-    printf("[%s]", NodeKindStr[node->node_kind]);
+static TreeNode *Expr(CompilerInfo *pci, ParseInfo *ppi, int min_precedence = COMPARE_PRECEDENCE);
 
-    if (node->node_kind == OPER_NODE) printf("[%s]", TokenTypeStr[node->oper]);
-    else if (node->node_kind == NUM_NODE) printf("[%d]", node->num);
-    else if (node->node_kind == ID_NODE || node->node_kind == READ_NODE || node->node_kind == ASSIGN_NODE)
-        printf("[%s]", node->id);
+static void StartExpr(CompilerInfo *pci, ParseInfo *ppi, int min_precedence, bool paren);
 
-    if (node->expr_data_type != VOID) printf("[%s]", ExprDataTypeStr[node->expr_data_type]);
+static TreeNode *NewExpr(CompilerInfo *pci, ParseInfo *ppi);
 
-    printf("\n");
 
-    for (i = 0; i < MAX_CHILDREN; i++) if (node->child[i]) PrintTree(node->child[i], sh + NSH);
-    if (node->sibling) PrintTree(node->sibling, sh);
+// Moves to the next token. The last of the pre-scanned tokens (end of file or error) is never passed.
+void AdvanceToken(CompilerInfo *pci, ParseInfo *ppi) {
+    if (!ppi->tokens) {
+        GetNextToken(pci, &ppi->next_token, &ppi->next_value);
+        return;
+    }
+    size_t i = ppi->next_index;
+    if (i + 1 < ppi->tokens->tokens.size()) ppi->next_index++;
+    ppi->next_token = ppi->tokens->tokens[i];
+    ppi->next_value = ppi->tokens->values[i];
 }
 
-void DestroyTree(TreeNode *node) {
-    int i;
+int NextTokenLine(CompilerInfo *pci, ParseInfo *ppi) {
+    return pci->in_file.LineNum(ppi->next_token.pos);
+}
 
-    if (node->node_kind == ID_NODE || node->node_kind == READ_NODE || node->node_kind == ASSIGN_NODE)
-        if (node->id) delete[] node->id;
+void Match(CompilerInfo *pci, ParseInfo *ppi, TokenType expected_token_type) {
+    TRACE_RULE(pci, "Start Match");
 
-    for (i = 0; i < MAX_CHILDREN; i++) if (node->child[i]) DestroyTree(node->child[i]);
-    if (node->sibling) DestroyTree(node->sibling);
+    if (ppi->next_token.type != expected_token_type) throw 0;
+    AdvanceToken(pci, ppi);
 
-    delete node;
+    TRACE_TOKEN(pci, NextTokenLine(pci, ppi), ppi->next_token.type, pci->in_file.Text(ppi->next_token.pos),
+                ppi->next_token.len);
 }
 
+// true if the next token is in the Follow() of StmtSeq()
+bool AtStmtSeqEnd(ParseInfo *ppi) {
+    TokenType type = ppi->next_token.type;
+    return type == ENDFILE || type == END || type == ELSE || type == UNTIL;
+}
 
-////////////////////////////////////////////////////////////////////////////////////
-// Analyzer ////////////////////////////////////////////////////////////////////////
-
-const int SYMBOL_HASH_SIZE = 10007;
-
-struct LineLocation {
-    int line_num;
-    LineLocation *next;
-};
+// Starts parsing a stmtseq that becomes child of owner
+void StartStmtSeq(CompilerInfo *pci, vector<StmtSeqFrame> *stack, TreeNode *owner, int child) {
+    TRACE_RULE(pci, "Start StmtSeq");
 
-struct VariableInfo {
-    char *name;
-    int memloc;
-    LineLocation *head_line; // the head of linked list of source line locations
-    LineLocation *tail_line; // the tail of linked list of source line locations
-    VariableInfo *next_var; // the next variable in the linked list in the same hash bucket of the symbol table
-};
+    StmtSeqFrame frame;
+    frame.first_tree = frame.last_tree = 0;
+    frame.owner = owner;
+    frame.child = child;
+    stack->push_back(frame);
+}
 
-struct SymbolTable {
-    int num_vars;
-    VariableInfo *var_info[SYMBOL_HASH_SIZE];
+// stmtseq -> stmt { ; stmt }
+// Nested sequences (in if and repeat) are kept on an explicit stack instead of the call stack, so neither
+// long nor deeply nested programs can overflow it. With a handler the top-level statements are not linked:
+// each one goes to handler (which owns it from then on) as soon as it is parsed, and 0 is returned.
+TreeNode *StmtSeq(CompilerInfo *pci, ParseInfo *ppi, StmtHandler handler, void *data) {
+    vector<StmtSeqFrame> stack;
+    StartStmtSeq(pci, &stack, 0, 0);
+
+    while (true) {
+        // 0 if an if/repeat started, its stmtseq is on the stack now
+        TreeNode *tree = Stmt(pci, ppi, &stack);
+
+        while (tree) {
+            StmtSeqFrame *frame = &stack.back();
+            if (handler && stack.size() == 1) handler(tree, data);
+            else if (!frame->first_tree) frame->first_tree = frame->last_tree = tree;
+            else {
+                frame->last_tree->sibling = tree;
+                frame->last_tree = tree;
+            }
 
-    SymbolTable() {
-        num_vars = 0;
-        int i;
-        for (i = 0; i < SYMBOL_HASH_SIZE; i++) var_info[i] = 0;
-    }
+            // If we did not reach one of the Follow() of StmtSeq(), we are not done yet
+            if (!AtStmtSeqEnd(ppi)) {
+                Match(pci, ppi, SEMI_COLON);
+                break;
+            }
 
-    int Hash(const char *name) {
-        int i, len = strlen(name);
-        int hash_val = 11;
-        for (i = 0; i < len; i++) hash_val = (hash_val * 17 + (int) name[i]) % SYMBOL_HASH_SIZE;
-        return hash_val;
-    }
+            TRACE_RULE(pci, "End StmtSeq");
+            StmtSeqFrame seq = *frame;
+            stack.pop_back();
+            if (!seq.owner) return seq.first_tree;
 
-    VariableInfo *Find(const char *name) {
-        int h = Hash(name);
-        VariableInfo *cur = var_info[h];
-        while (cur) {
-            if (Equals(name, cur->name)) return cur;
-            cur = cur->next_var;
+            // the statement that the sequence was part of may be complete now
+            tree = EndCompoundStmt(pci, ppi, &stack, &seq);
         }
-        return 0;
     }
+}
 
-    void Insert(const char *name, int line_num) {
-        LineLocation *lineloc = new LineLocation;
-        lineloc->line_num = line_num;
-        lineloc->next = 0;
+// stmt -> ifstmt | repeatstmt | assignstmt | readstmt | writestmt
+// Returns 0 for if and repeat, which are completed by EndCompoundStmt()
+TreeNode *Stmt(CompilerInfo *pci, ParseInfo *ppi, vector<StmtSeqFrame> *stack) {
+    TRACE_RULE(pci, "Start Stmt");
 
-        int h = Hash(name);
-        VariableInfo *prev = 0;
-        VariableInfo *cur = var_info[h];
+    // Compare the next token with the First() of possible statements
+    TreeNode *tree = 0;
+    if (ppi->next_token.type == IF) return IfStmt(pci, ppi, stack);
+    else if (ppi->next_token.type == REPEAT) return RepeatStmt(pci, ppi, stack);
+    else if (ppi->next_token.type == ID) tree = AssignStmt(pci, ppi);
+    else if (ppi->next_token.type == READ) tree = ReadStmt(pci, ppi);
+    else if (ppi->next_token.type == WRITE) tree = WriteStmt(pci, ppi);
+    else throw 0;
 
-        while (cur) {
-            if (Equals(name, cur->name)) {
-                // just add this line location to the list of line locations of the existing var
-                cur->tail_line->next = lineloc;
-                cur->tail_line = lineloc;
-                return;
-            }
-            prev = cur;
-            cur = cur->next_var;
-        }
+    TRACE_RULE(pci, "End Stmt");
+    return tree;
+}
 
-        VariableInfo *vi = new VariableInfo;
-        vi->head_line = vi->tail_line = lineloc;
-        vi->next_var = 0;
-        vi->memloc = 0;
-        AllocateAndCopy(&vi->name, name);
+// ifstmt -> if exp then stmtseq [ else stmtseq ] end
+// Parses up to the first stmtseq, see EndCompoundStmt() for the rest
+TreeNode *IfStmt(CompilerInfo *pci, ParseInfo *ppi, vector<StmtSeqFrame> *stack) {
+    TRACE_RULE(pci, "Start IfStmt");
 
-        if (!prev) var_info[h] = vi;
-        else prev->next_var = vi;
-    }
+    TreeNode *tree = NewNode(pci);
+    tree->node_kind = IF_NODE;
+    tree->line_num = NextTokenLine(pci, ppi);
 
-    void Print() {
-        int i;
-        for (i = 0; i < SYMBOL_HASH_SIZE; i++) {
-            VariableInfo *curv = var_info[i];
-            while (curv) {
-                printf("[Var=%s][Mem=%d]", curv->name, curv->memloc);
-                LineLocation *curl = curv->head_line;
-                while (curl) {
-                    printf("[Line=%d]", curl->line_num);
-                    curl = curl->next;
-                }
-                printf("\n");
-                curv = curv->next_var;
-            }
-        }
-    }
+    Match(pci, ppi, IF);
+    tree->child[0] = Expr(pci, ppi);
+    Match(pci, ppi, THEN);
+    StartStmtSeq(pci, stack, tree, 1);
+    return 0;
+}
 
-    void Destroy() {
-        int i;
-        for (i = 0; i < SYMBOL_HASH_SIZE; i++) {
-            VariableInfo *curv = var_info[i];
-            while (curv) {
-                LineLocation *curl = curv->head_line;
-                while (curl) {
-                    LineLocation *pl = curl;
-                    curl = curl->next;
-                    delete pl;
-                }
-                VariableInfo *p = curv;
-                curv = curv->next_var;
-                delete p;
-            }
-            var_info[i] = 0;
-        }
-    }
-};
+// repeatstmt -> repeat stmtseq until expr
+// Parses up to the stmtseq, see EndCompoundStmt() for the rest
+TreeNode *RepeatStmt(CompilerInfo *pci, ParseInfo *ppi, vector<StmtSeqFrame> *stack) {
+    TRACE_RULE(pci, "Start RepeatStmt");
 
-static void buildSymbolTable(SymbolTable *symbolTable, TreeNode *currentNode);
+    TreeNode *tree = NewNode(pci);
+    tree->node_kind = REPEAT_NODE;
+    tree->line_num = NextTokenLine(pci, ppi);
 
-static void CheckNode(TreeNode *currentNode);
+    Match(pci, ppi, REPEAT);
+    StartStmtSeq(pci, stack, tree, 0);
+    return 0;
+}
 
-static void TypeCheck(TreeNode *currentNode);
+// Continues the if/repeat statement after its stmtseq seq ended. Returns the statement when it is complete,
+// 0 if the else part started.
+TreeNode *EndCompoundStmt(CompilerInfo *pci, ParseInfo *ppi, vector<StmtSeqFrame> *stack,
+                          const StmtSeqFrame *seq) {
+    TreeNode *tree = seq->owner;
+    tree->child[seq->child] = seq->first_tree;
+
+    if (tree->node_kind == IF_NODE) {
+        if (seq->child == 1 && ppi->next_token.type == ELSE) {
+            Match(pci, ppi, ELSE);
+            StartStmtSeq(pci, stack, tree, 2);
+            return 0;
+        }
+        Match(pci, ppi, END);
 
-// takes the root of the parse tree and builds the symbol table
-void buildSymbolTable(SymbolTable *symbolTable, TreeNode *currentNode) {
-    if (currentNode == nullptr)
-        return;
+        TRACE_RULE(pci, "End IfStmt");
+    } else {
+        Match(pci, ppi, UNTIL);
+        tree->child[1] = Expr(pci, ppi);
 
-    if (currentNode->node_kind == ID_NODE || currentNode->node_kind == ASSIGN_NODE ||
-        currentNode->node_kind == READ_NODE) {
-        symbolTable->Insert(currentNode->id, currentNode->line_num);
+        TRACE_RULE(pci, "End RepeatStmt");
     }
 
-    if(currentNode->node_kind == ASSIGN_NODE && currentNode->child[0]->node_kind == NUM_NODE) {
-        VariableInfo* variableInfo = symbolTable->var_info[symbolTable->Hash(currentNode->id)];
+    TRACE_RULE(pci, "End Stmt");
+    return tree;
+}
+
+// assignstmt -> identifier := expr
+TreeNode *AssignStmt(CompilerInfo *pci, ParseInfo *ppi) {
+    TRACE_RULE(pci, "Start AssignStmt");
 
-        // the first time that the variable appears
-        if(variableInfo->head_line->line_num == currentNode->line_num)
-            variableInfo->memloc = currentNode->child[0]->num;
-    }
+    TreeNode *tree = NewNode(pci);
+    tree->node_kind = ASSIGN_NODE;
+    tree->line_num = NextTokenLine(pci, ppi);
 
-    // build children
-    for (int i = 0; i < MAX_CHILDREN; i++) {
-        buildSymbolTable(symbolTable, currentNode->child[i]);
-    }
+    tree->id = ppi->next_value;
+    Match(pci, ppi, ID);
+    Match(pci, ppi, ASSIGN);
+    tree->child[0] = Expr(pci, ppi);
 
-    // build siblings
-    buildSymbolTable(symbolTable, currentNode->sibling);
+    TRACE_RULE(pci, "End AssignStmt");
+    return tree;
 }
 
-// performs type checking on the syntax tree
-// by postorder traversal
-void TypeCheck(TreeNode *currentNode) {
-    if (currentNode == NULL)
-        return;
+// readstmt -> read identifier
+TreeNode *ReadStmt(CompilerInfo *pci, ParseInfo *ppi) {
+    TRACE_RULE(pci, "Start ReadStmt");
+
+    TreeNode *tree = NewNode(pci);
+    tree->node_kind = READ_NODE;
+    tree->line_num = NextTokenLine(pci, ppi);
 
-    for (int i = 0; i < MAX_CHILDREN; i++)
-        TypeCheck(currentNode->child[i]);
+    Match(pci, ppi, READ);
+    tree->id = ppi->next_value;
+    Match(pci, ppi, ID);
 
-    CheckNode(currentNode);
-    TypeCheck(currentNode->sibling);
+    TRACE_RULE(pci, "End ReadStmt");
+    return tree;
 }
 
+// writestmt -> write expr
+TreeNode *WriteStmt(CompilerInfo *pci, ParseInfo *ppi) {
+    TRACE_RULE(pci, "Start WriteStmt");
 
-void CheckNode(TreeNode *currentNode) {
-    switch (currentNode->node_kind) {
-        case IF_NODE:
-            if (currentNode->child[0]->expr_data_type != BOOLEAN)
-                printf("Error: Condition in 'if' statement must must be Boolean data type.\n");
+    TreeNode *tree = NewNode(pci);
+    tree->node_kind = WRITE_NODE;
+    tree->line_num = NextTokenLine(pci, ppi);
+
+    Match(pci, ppi, WRITE);
+    tree->child[0] = Expr(pci, ppi);
+
+    TRACE_RULE(pci, "End WriteStmt");
+    return tree;
+}
+
+// Parses an expression of the operators with at least min_precedence (precedence climbing): expr for
+// COMPARE_PRECEDENCE, mathexpr for ADD_PRECEDENCE. The right operand of an operator is an expression of the higher
+// precedences, and a parenthesis holds a mathexpr; each is parsed in a new ExprFrame on ppi->expr_stack instead of
+// a nested call, so neither long nor deeply nested expressions can overflow the call stack. A right associative
+// chain (a ^ b ^ c) is built in its frame: each new operator takes the last operand as its left child and becomes
+// the right child of the operator before it.
+TreeNode *Expr(CompilerInfo *pci, ParseInfo *ppi, int min_precedence) {
+    vector<ExprFrame> &stack = ppi->expr_stack;
+    stack.clear();
+    StartExpr(pci, ppi, min_precedence, false);
+
+    while (true) {
+        TreeNode *operand = NewExpr(pci, ppi);
+
+        // 0 if a ( started a frame, else the operand completes frames until an operator starts one
+        while (operand) {
+            ExprFrame *frame = &stack.back();
+            bool done = false;
+            if (!frame->oper) frame->tree = operand;
+            else {
+                TreeNode *new_tree = frame->oper;
+                OperInfo info = oper_table.info[new_tree->oper];
+                new_tree->child[1] = operand;
+                frame->oper = 0;
+
+                TreeNode *last_right = frame->last_right;
+                bool continues_chain = last_right && oper_table.info[last_right->oper].precedence == info.precedence;
+                if (info.assoc == RIGHT_ASSOC && continues_chain) {
+                    new_tree->child[0] = last_right->child[1];
+                    last_right->child[1] = new_tree;
+                } else {
+                    new_tree->child[0] = frame->tree;
+                    frame->tree = new_tree;
+                }
+                frame->last_right = info.assoc == RIGHT_ASSOC ? new_tree : 0;
+
+                // a < b < c is an error, the second < is left to the caller
+                done = info.assoc == NON_ASSOC;
+            }
+
+            OperInfo info = oper_table.info[ppi->next_token.type];
+            if (!done && info.precedence != NO_PRECEDENCE && info.precedence >= frame->min_precedence) {
+                TreeNode *new_tree = NewNode(pci);
+                new_tree->node_kind = OPER_NODE;
+                new_tree->oper = ppi->next_token.type;
+                new_tree->line_num = NextTokenLine(pci, ppi);
+                frame->oper = new_tree;
+
+                Match(pci, ppi, ppi->next_token.type);
+                StartExpr(pci, ppi, info.precedence + 1, false);
+                break;
+            }
+
+            TRACE_RULE(pci, "End Expr");
+            ExprFrame end = *frame;
+            stack.pop_back();
+            if (end.paren) {
+                Match(pci, ppi, RIGHT_PAREN);
+                TRACE_RULE(pci, "End NewExpr");
+            }
+            if (stack.empty()) return end.tree;
+            operand = end.tree;
+        }
+    }
+}
+
+// Starts the frame of an expression in Expr(), paren if it is the mathexpr of ( mathexpr )
+void StartExpr(CompilerInfo *pci, ParseInfo *ppi, int min_precedence, bool paren) {
+    TRACE_RULE(pci, "Start Expr");
+    ExprFrame frame = {0, 0, 0, min_precedence, paren};
+    ppi->expr_stack.push_back(frame);
+}
+
+// newexpr -> ( mathexpr ) | number | identifier
+// Returns 0 for a (, its mathexpr is a new frame of Expr()
+TreeNode *NewExpr(CompilerInfo *pci, ParseInfo *ppi) {
+    TRACE_RULE(pci, "Start NewExpr");
+
+    // Compare the next token with the First() of possible statements
+    if (ppi->next_token.type == NUM) {
+        TreeNode *tree = NewNode(pci);
+        tree->node_kind = NUM_NODE;
+        tree->num = ppi->next_value;
+        tree->line_num = NextTokenLine(pci, ppi);
+        Match(pci, ppi, ppi->next_token.type);
+
+        TRACE_RULE(pci, "End NewExpr");
+        return tree;
+    }
+
+    if (ppi->next_token.type == ID) {
+        TreeNode *tree = NewNode(pci);
+        tree->node_kind = ID_NODE;
+        tree->id = ppi->next_value;
+        tree->line_num = NextTokenLine(pci, ppi);
+        Match(pci, ppi, ppi->next_token.type);
+
+        TRACE_RULE(pci, "End NewExpr");
+        return tree;
+    }
+
+    if (ppi->next_token.type == LEFT_PAREN) {
+        Match(pci, ppi, LEFT_PAREN);
+        StartExpr(pci, ppi, ADD_PRECEDENCE, true);
+        return 0;
+    }
+
+    throw 0;
+    return 0;
+}
+
+
+// program -> stmtseq
+// With prescan the whole source is scanned into a TokenArray first, on scan_threads threads. Pre-scanned tokens
+// need the mapped source for their text and line numbers, so the stdio mode always scans while parsing.
+TreeNode *Parse(CompilerInfo *pci, bool prescan = false, int scan_threads = 1) {
+    ParseInfo parse_info;
+    TokenArray token_array;
+    if (prescan && pci->in_file.map_buf) {
+        ScanAllParallel(pci, &token_array, scan_threads);
+        parse_info.tokens = &token_array;
+    }
+    AdvanceToken(pci, &parse_info);
+
+    TreeNode *syntax_tree = StmtSeq(pci, &parse_info);
+
+    if (parse_info.next_token.type != ENDFILE)
+        pci->debug_file.Out("Error code ends before file ends");
+
+    return syntax_tree;
+}
+
+// program -> stmtseq
+// Like Parse() but the top-level statements are not linked into a tree: each one goes to handler (which owns it
+// from then on) as soon as it is parsed, so only the statement being parsed is in memory.
+void ParseStream(CompilerInfo *pci, StmtHandler handler, void *data) {
+    ParseInfo parse_info;
+    AdvanceToken(pci, &parse_info);
+
+    StmtSeq(pci, &parse_info, handler, data);
+
+    if (parse_info.next_token.type != ENDFILE)
+        pci->debug_file.Out("Error code ends before file ends");
+}
+
+// The tree passes do not recurse: the nodes still to visit are kept on an explicit work stack, which only
+// grows with the nesting depth of the tree, never with the length of a statement sequence.
+
+void PrintTree(const Interner *names, TreeNode *root, int root_sh = 0) {
+    int i, NSH = 3;
+    vector<pair<TreeNode *, int> > stack; // nodes to print, with their indentation
+    stack.push_back(make_pair(root, root_sh));
+
+    while (!stack.empty()) {
+        TreeNode *node = stack.back().first;
+        int sh = stack.back().second;
+        stack.pop_back();
+
+        for (i = 0; i < sh; i++) printf(" ");
+
+        printf("[%s]", NodeKindStr[node->node_kind]);
+
+        if (node->node_kind == OPER_NODE) printf("[%s]", TokenTypeStr[node->oper]);
+        else if (node->node_kind == NUM_NODE) printf("[%d]", node->num);
+        else if (node->node_kind == ID_NODE || node->node_kind == READ_NODE || node->node_kind == ASSIGN_NODE)
+            printf("[%s]", names->Name(node->id));
+
+        if (node->expr_data_type != VOID) printf("[%s]", ExprDataTypeStr[node->expr_data_type]);
+
+        printf("\n");
+
+        // children first, then the sibling
+        if (node->sibling) stack.push_back(make_pair(node->sibling, sh));
+        for (i = MAX_CHILDREN - 1; i >= 0; i--)
+            if (node->child[i]) stack.push_back(make_pair(node->child[i], sh + NSH));
+    }
+}
+
+// Frees all trees parsed so far
+void DestroyTrees(CompilerInfo *pci) {
+    pci->tree_arena.Reset();
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////
+// Analyzer ////////////////////////////////////////////////////////////////////////
+
+#define LINE_CHUNK_FIRST_SIZE 4
+#define LINE_CHUNK_MAX_SIZE 1024
+
+// The source lines of a variable are kept in a list of chunks of line numbers, allocated from the pool of the
+// symbol table. The chunks of each variable double in size up to LINE_CHUNK_MAX_SIZE, so a variable used once
+// takes one small chunk and one used a million times takes about a thousand.
+struct LineChunk {
+    LineChunk *next;
+    int size; // the capacity of line_num
+    int count; // the used part of line_num
+    int *line_num; // follows the chunk in the pool
+};
+
+struct VariableInfo {
+    int id; // see Interner
+    int memloc; // the slot of the variable in an array of all variables, see AssignSlots()
+    int num_refs; // the number of lines that use the variable, also counted when they are not kept
+    int first_line; // the line of the first use
+    LineChunk *head_chunk; // the chunks of source line locations
+    LineChunk *tail_chunk;
+};
+
+// Variables are indexed by their identifier id, so no lookup needs to hash or compare names
+struct SymbolTable {
+    const Interner *names;
+    int num_vars;
+    vector<VariableInfo *> var_info; // 0 for identifiers that are not in the table (yet)
+    bool keep_lines; // false to record only the first line of each variable (all code generation needs)
+    Arena pool; // all VariableInfos and LineChunks, released at once by Destroy()
+
+    SymbolTable(const Interner *_names, bool _keep_lines = true) {
+        names = _names;
+        num_vars = 0;
+        keep_lines = _keep_lines;
+    }
+
+    VariableInfo *Find(int id) {
+        if (id < 0 || id >= (int) var_info.size()) return 0;
+        return var_info[id];
+    }
+
+    LineChunk *NewChunk(int size) {
+        LineChunk *chunk = (LineChunk *) pool.Allocate(sizeof(LineChunk) + size * sizeof(int));
+        chunk->next = 0;
+        chunk->size = size;
+        chunk->count = 0;
+        chunk->line_num = (int *) (chunk + 1);
+        return chunk;
+    }
+
+    // Adds a use of the variable id on line line_num, returns the variable
+    VariableInfo *Insert(int id, int line_num) {
+        VariableInfo *cur = Find(id);
+        if (cur) {
+            cur->num_refs++;
+            if (!keep_lines) return cur;
+
+            // just add this line location to the lines of the existing var
+            LineChunk *tail = cur->tail_chunk;
+            if (tail->count == tail->size) {
+                tail->next = NewChunk(tail->size < LINE_CHUNK_MAX_SIZE ? 2 * tail->size : tail->size);
+                tail = cur->tail_chunk = tail->next;
+            }
+            tail->line_num[tail->count++] = line_num;
+            return cur;
+        }
+
+        VariableInfo *vi = (VariableInfo *) pool.Allocate(sizeof(VariableInfo));
+        vi->head_chunk = vi->tail_chunk = NewChunk(keep_lines ? LINE_CHUNK_FIRST_SIZE : 1);
+        vi->head_chunk->line_num[vi->head_chunk->count++] = line_num;
+        vi->first_line = line_num;
+        vi->num_refs = 1;
+        vi->memloc = num_vars; // in the order the variables are seen, until AssignSlots()
+        vi->id = id;
+
+        if (id >= (int) var_info.size()) var_info.resize(id + 1, 0);
+        var_info[id] = vi;
+        num_vars++;
+        return vi;
+    }
+
+    static bool MoreReferenced(const VariableInfo *a, const VariableInfo *b) { return a->num_refs > b->num_refs; }
+
+    // Numbers the variables 0..num_vars-1 by their references, the most used ones first, and ties in the order
+    // the variables were seen. A backend can keep all variables in one array indexed by these slots, with the
+    // busiest ones close together at its start.
+    void AssignSlots() {
+        vector<VariableInfo *> vars;
+        int i;
+        for (i = 0; i < (int) var_info.size(); i++) if (var_info[i]) vars.push_back(var_info[i]);
+        stable_sort(vars.begin(), vars.end(), MoreReferenced);
+        for (i = 0; i < (int) vars.size(); i++) vars[i]->memloc = i;
+    }
+
+    void Print() {
+        PrintBuffer out(stdout);
+        int i, j;
+        for (i = 0; i < (int) var_info.size(); i++) {
+            VariableInfo *curv = var_info[i];
+            if (!curv) continue;
+            out.Add("[Var=");
+            out.Add(names->Name(curv->id));
+            out.Add("][Mem=");
+            out.AddInt(curv->memloc);
+            out.Add("]");
+            LineChunk *chunk;
+            for (chunk = curv->head_chunk; chunk; chunk = chunk->next) {
+                for (j = 0; j < chunk->count; j++) {
+                    out.Add("[Line=", 6);
+                    out.AddInt(chunk->line_num[j]);
+                    out.Add("]", 1);
+                }
+            }
+            out.Add("\n", 1);
+        }
+    }
+
+    void Destroy() {
+        pool.Reset();
+        var_info.clear();
+        num_vars = 0;
+    }
+};
+
+enum TypeError {IF_TYPE_ERROR, REPEAT_TYPE_ERROR, ASSIGN_TYPE_ERROR, WRITE_TYPE_ERROR, OPER_TYPE_ERROR};
+
+const char *const TypeErrorStr[] = {
+        "Condition in 'if' statement must must be Boolean data type.",
+        "Repeat condition must must be Boolean data type.",
+        "Assignment requires both sides to be of Integer data type.",
+        "'write' statement expects an Integer value.",
+        "Operation must be applied to Integer values."
+};
+
+// the line is the line of the statement or operator that has the error
+void PrintTypeError(TypeError error, int line_num) {
+    printf("Error at line %d: %s\n", line_num, TypeErrorStr[error]);
+}
+
+// an error kept to be reported again, see FlatTree
+struct ReportedTypeError {
+    int error; // TypeError
+    int line_num;
+};
+
+static void CheckNode(TreeNode *currentNode);
+
+// The semantic analysis of the tree under root (and its siblings), in one traversal:
+// - entering a node (preorder: node, children, sibling) enters its variable in the symbol table, and
+//   records the variable and whether this is its first line in the node, for code generation
+// - leaving a node (postorder: children, node, sibling) type checks it
+void Analyze(SymbolTable *symbolTable, TreeNode *root) {
+    vector<pair<TreeNode *, int> > stack; // nodes with the index of their next child to analyze
+    if (root) stack.push_back(make_pair(root, 0));
+
+    while (!stack.empty()) {
+        TreeNode *currentNode = stack.back().first;
+        int i = stack.back().second;
+
+        if (i == 0 && (currentNode->node_kind == ID_NODE || currentNode->node_kind == ASSIGN_NODE ||
+                       currentNode->node_kind == READ_NODE)) {
+            currentNode->var = symbolTable->Insert(currentNode->id, currentNode->line_num);
+            currentNode->first_use = currentNode->var->first_line == currentNode->line_num;
+        }
+
+        if (i < MAX_CHILDREN) {
+            stack.back().second++;
+            if (currentNode->child[i]) stack.push_back(make_pair(currentNode->child[i], 0));
+            continue;
+        }
+
+        CheckNode(currentNode);
+        stack.pop_back();
+        if (currentNode->sibling) stack.push_back(make_pair(currentNode->sibling, 0));
+    }
+}
+
+void CheckNode(TreeNode *currentNode) {
+    switch (currentNode->node_kind) {
+        case IF_NODE:
+            if (currentNode->child[0]->expr_data_type != BOOLEAN)
+                PrintTypeError(IF_TYPE_ERROR, currentNode->line_num);
             break;
         case REPEAT_NODE:
             if (currentNode->child[1]->expr_data_type != BOOLEAN)
-                printf("Error: Repeat condition must must be Boolean data type.\n");
+                PrintTypeError(REPEAT_TYPE_ERROR, currentNode->line_num);
             break;
         case ASSIGN_NODE:
             if (currentNode->child[0]->expr_data_type != INTEGER)
-                printf("Error: Assignment requires both sides to be of Integer data type.\n");
+                PrintTypeError(ASSIGN_TYPE_ERROR, currentNode->line_num);
             break;
         case WRITE_NODE:
             if (currentNode->child[0]->expr_data_type != INTEGER)
-                printf("Error: 'write' statement expects an Integer value.\n");
+                PrintTypeError(WRITE_TYPE_ERROR, currentNode->line_num);
             break;
         case OPER_NODE:
             if (currentNode->child[0]->expr_data_type != INTEGER ||
                 currentNode->child[1]->expr_data_type != INTEGER)
-                printf("Error: Operation must be applied to Integer values.\n");
+                PrintTypeError(OPER_TYPE_ERROR, currentNode->line_num);
             if (currentNode->oper == EQUAL || currentNode->oper == LESS_THAN)
                 currentNode->expr_data_type = BOOLEAN;
             else
@@ -897,135 +2048,4261 @@ void CheckNode(TreeNode *currentNode) {
     }
 }
 
-void handleIdDatatype(FILE *file, SymbolTable *symbolTable, TreeNode *currentNode) {
-    int firstLineAppearance = symbolTable->var_info[symbolTable->Hash(currentNode->id)]->head_line->line_num;
-    if (firstLineAppearance == currentNode->line_num)
+void handleIdDatatype(FILE *file, TreeNode *currentNode) {
+    if (currentNode->first_use)
         fprintf(file, "int ");
 }
 
-void SimulateNode(FILE *file, SymbolTable *symbolTable, TreeNode *currentNode) {
-    if (currentNode == NULL)
+// The C++ operator of a binary TINY operator, 0 for ^ (IntPow()) and other tokens
+const char *OperCode(TokenType oper) {
+    switch (oper) {
+        case EQUAL:
+            return "==";
+        case LESS_THAN:
+            return "<";
+        case PLUS:
+            return "+";
+        case MINUS:
+            return "-";
+        case TIMES:
+            return "*";
+        case DIVIDE:
+            return "/";
+        default:
+            return 0;
+    }
+}
+
+// Writes the start of x ^ k for a number k >= 0 in the generated code, the CONST_POWER of ReduceStrength(): a lambda
+// with the squarings of IntPow() unrolled, called on x so that x is evaluated once. g++ makes * and / by a number
+// cheaper itself, even at -O0, but not the IntPow() loop.
+void SimulatePowerStart(FILE *file, int k) {
+    if (!k) {
+        fprintf(file, "[](unsigned) { return 1; }(");
         return;
+    }
+    fprintf(file, "[](unsigned a) { unsigned r = a;");
+    int bit = 30;
+    while (!(k >> bit & 1)) bit--;
+    for (bit--; bit >= 0; bit--) fprintf(file, k >> bit & 1 ? " r *= r; r *= a;" : " r *= r;");
+    fprintf(file, " return (int) r; }(");
+}
 
-    switch (currentNode->node_kind) {
-        case IF_NODE:
-            fprintf(file, "if (");
-            SimulateNode(file, symbolTable, currentNode->child[0]);
-            fprintf(file, ")\n{\n");
-            SimulateNode(file, symbolTable, currentNode->child[1]);
-            fprintf(file, "\n}\n");
-            break;
-        case REPEAT_NODE:
-            /*
-             * repeat
-             *     statement
-             * until condition
-             *
-             * do {
-             *     statement
-             * } while(condition);
-             */
-            fprintf(file, "do {\n");
-            SimulateNode(file, symbolTable, currentNode->child[0]);
-            fprintf(file, "} while(!(");
-            SimulateNode(file, symbolTable, currentNode->child[1]);
-            fprintf(file, "));\n\n");
-            break;
-        case ASSIGN_NODE: {
-            handleIdDatatype(file, symbolTable, currentNode);
-            fprintf(file, "%s = ", currentNode->id);
-            SimulateNode(file, symbolTable, currentNode->child[0]);
-            fprintf(file, ";\n");
-            break;
+// A part of the simulation that is still to be written: a node (with its siblings) or text
+struct SimulationItem {
+    TreeNode *node;
+    const char *text;
+};
+
+void PushSimulation(vector<SimulationItem> *stack, TreeNode *node, const char *text = 0) {
+    if (!node && !text) return;
+    SimulationItem item;
+    item.node = node;
+    item.text = text;
+    stack->push_back(item);
+}
+
+// Writes the code of a node and its siblings. What a node writes before its first child is written right away,
+// the rest is pushed on the stack in reverse order.
+void SimulateNode(FILE *file, SymbolTable *symbolTable, TreeNode *root) {
+    vector<SimulationItem> stack;
+    PushSimulation(&stack, root);
+
+    while (!stack.empty()) {
+        SimulationItem item = stack.back();
+        stack.pop_back();
+        if (item.text) {
+            fprintf(file, "%s", item.text);
+            continue;
         }
-        case WRITE_NODE:
-            fprintf(file, "cout << \"%s: \"<< %s << \"\\n\";\n", currentNode->child[0]->id, currentNode->child[0]->id);
-            break;
-        case READ_NODE:
-            fprintf(file, "int %s;\n", currentNode->id);
-            fprintf(file, "cout << \"Enter %s: \";", currentNode->id);
-            fprintf(file, "cin >> %s;\n", currentNode->id);
-            break;
-        case OPER_NODE:
-            switch (currentNode->oper) {
-                case EQUAL:
-                    SimulateNode(file, symbolTable, currentNode->child[0]);
-                    fprintf(file, "==");
-                    SimulateNode(file, symbolTable, currentNode->child[1]);
-                    break;
-                case LESS_THAN:
-                    SimulateNode(file, symbolTable, currentNode->child[0]);
-                    fprintf(file, "<");
-                    SimulateNode(file, symbolTable, currentNode->child[1]);
-                    break;
-                case PLUS:
-                    SimulateNode(file, symbolTable, currentNode->child[0]);
-                    fprintf(file, "+");
-                    SimulateNode(file, symbolTable, currentNode->child[1]);
-                    break;
-                case MINUS:
-                    SimulateNode(file, symbolTable, currentNode->child[0]);
-                    fprintf(file, "-");
-                    SimulateNode(file, symbolTable, currentNode->child[1]);
-                    break;
-                case TIMES:
-                    SimulateNode(file, symbolTable, currentNode->child[0]);
-                    fprintf(file, "*");
-                    SimulateNode(file, symbolTable, currentNode->child[1]);
-                    break;
-                case DIVIDE:
-                    SimulateNode(file, symbolTable, currentNode->child[0]);
-                    fprintf(file, "/");
-                    SimulateNode(file, symbolTable, currentNode->child[1]);
-                    break;
-                case POWER:
-                    fprintf(file, "pow(");
-                    SimulateNode(file, symbolTable, currentNode->child[0]);
-                    fprintf(file, ",");
-                    SimulateNode(file, symbolTable, currentNode->child[1]);
-                    fprintf(file, ")");
-                    break;
-                default:
-                    break;
+
+        TreeNode *currentNode = item.node;
+        PushSimulation(&stack, currentNode->sibling);
+
+        switch (currentNode->node_kind) {
+            case IF_NODE:
+                fprintf(file, "if (");
+                PushSimulation(&stack, 0, "\n}\n");
+                if (currentNode->child[2]) {
+                    PushSimulation(&stack, currentNode->child[2]);
+                    PushSimulation(&stack, 0, "\n}\nelse\n{\n");
+                }
+                PushSimulation(&stack, currentNode->child[1]);
+                PushSimulation(&stack, 0, ")\n{\n");
+                PushSimulation(&stack, currentNode->child[0]);
+                break;
+            case REPEAT_NODE:
+                /*
+                 * repeat
+                 *     statement
+                 * until condition
+                 *
+                 * do {
+                 *     statement
+                 * } while(condition);
+                 */
+                fprintf(file, "do {\n");
+                PushSimulation(&stack, 0, "));\n\n");
+                PushSimulation(&stack, currentNode->child[1]);
+                PushSimulation(&stack, 0, "} while(!(");
+                PushSimulation(&stack, currentNode->child[0]);
+                break;
+            case ASSIGN_NODE: {
+                handleIdDatatype(file, currentNode);
+                fprintf(file, "%s = ", symbolTable->names->Name(currentNode->id));
+                PushSimulation(&stack, 0, ";\n");
+                PushSimulation(&stack, currentNode->child[0]);
+                break;
             }
-            break;
-        case NUM_NODE:
-            fprintf(file, "%d", currentNode->num);
-            break;
-        case ID_NODE:
-            handleIdDatatype(file, symbolTable, currentNode);
-            fprintf(file, "%s", currentNode->id);
-            break;
-        default:
-            break;
+            case WRITE_NODE:
+                if (currentNode->child[0]->node_kind == ID_NODE) {
+                    fprintf(file, "cout << \"%s: \"<< %s << \"\\n\";\n",
+                            symbolTable->names->Name(currentNode->child[0]->id),
+                            symbolTable->names->Name(currentNode->child[0]->id));
+                } else {
+                    // an expression has no name to show, and << binds tighter than its operators
+                    fprintf(file, "cout << (");
+                    PushSimulation(&stack, 0, ") << \"\\n\";\n");
+                    PushSimulation(&stack, currentNode->child[0]);
+                }
+                break;
+            case READ_NODE: {
+                const char *name = symbolTable->names->Name(currentNode->id);
+                fprintf(file, "int %s;\n", name);
+                fprintf(file, "cout << \"Enter %s: \";", name);
+                fprintf(file, "cin >> %s;\n", name);
+                break;
+            }
+            case OPER_NODE: {
+                const char *oper_str = OperCode(currentNode->oper);
+                TreeNode *num = currentNode->child[1];
+                if (currentNode->oper == POWER && num->node_kind == NUM_NODE && num->num >= 0) {
+                    SimulatePowerStart(file, num->num);
+                    PushSimulation(&stack, 0, ")");
+                    PushSimulation(&stack, currentNode->child[0]);
+                } else if (currentNode->oper == POWER) {
+                    fprintf(file, "IntPow(");
+                    PushSimulation(&stack, 0, ")");
+                    PushSimulation(&stack, currentNode->child[1]);
+                    PushSimulation(&stack, 0, ",");
+                    PushSimulation(&stack, currentNode->child[0]);
+                } else if (oper_str) {
+                    // operands that are operations are parenthesized, the tree already has the TINY precedence
+                    bool paren[2];
+                    int k;
+                    for (k = 0; k < 2; k++) paren[k] = currentNode->child[k]->node_kind == OPER_NODE;
+                    if (paren[1]) PushSimulation(&stack, 0, ")");
+                    PushSimulation(&stack, currentNode->child[1]);
+                    if (paren[1]) PushSimulation(&stack, 0, "(");
+                    PushSimulation(&stack, 0, oper_str);
+                    if (paren[0]) PushSimulation(&stack, 0, ")");
+                    PushSimulation(&stack, currentNode->child[0]);
+                    if (paren[0]) PushSimulation(&stack, 0, "(");
+                }
+                break;
+            }
+            case NUM_NODE:
+                fprintf(file, "%d", currentNode->num);
+                break;
+            case ID_NODE:
+                handleIdDatatype(file, currentNode);
+                fprintf(file, "%s", symbolTable->names->Name(currentNode->id));
+                break;
+            default:
+                break;
+        }
     }
+}
+
+// TINY's ^ on ints, see IntPow()
+const char *const int_pow_code =
+        "int IntPow(int base, int exp)\n"
+        "{\n"
+        "if (exp < 0) return base == 1 || base == -1 ? (exp % 2 ? base : 1) : 0;\n"
+        "unsigned result = 1, factor = base;\n"
+        "for (; exp; exp >>= 1, factor *= factor) if (exp & 1) result *= factor;\n"
+        "return result;\n"
+        "}\n\n";
+
+void SimulateProgramStart(FILE *file) {
+    fprintf(file, "#include <iostream>\n\n using namespace std;\n\n%sint main()\n{", int_pow_code);
+}
 
-    if (currentNode->sibling != NULL)
-        SimulateNode(file, symbolTable, currentNode->sibling);
+void SimulateProgramEnd(FILE *file) {
+    fprintf(file, "return 0;\n}");
 }
 
 void SimulateProgram(SymbolTable *symbolTable, TreeNode *root) {
     FILE *simulationFile = fopen("simulation.cpp", "w");
-    fprintf(simulationFile, "#include <iostream>\n#include <cmath>\n\n using namespace std;\n\nint main()\n{");
+    SimulateProgramStart(simulationFile);
     SimulateNode(simulationFile, symbolTable, root);
-    fprintf(simulationFile, "return 0;\n}");
+    SimulateProgramEnd(simulationFile);
+}
+
+struct StreamInfo {
+    CompilerInfo *pci;
+    FILE *file;
+    SymbolTable *symbolTable;
+};
+
+// Analyzes, prints and simulates one top-level statement, then frees it
+void SimulateStatement(TreeNode *stmt, void *data) {
+    StreamInfo *psi = (StreamInfo *) data;
+    Analyze(psi->symbolTable, stmt); // the slots stay in the order the variables are seen
+    PrintTree(psi->symbolTable->names, stmt);
+    SimulateNode(psi->file, psi->symbolTable, stmt);
+    DestroyTrees(psi->pci);
+}
+
+// Streaming compile: code is emitted for each top-level statement as soon as it is parsed, so memory does not
+// grow with the program (only with its deepest statement and its variables). The tree is printed statement by
+// statement and the symbol table lists the first line of each variable only.
+void SimulateStream(CompilerInfo *pci) {
+    SymbolTable symbolTable(&pci->names, false);
+    StreamInfo stream_info;
+    stream_info.pci = pci;
+    stream_info.file = fopen("simulation.cpp", "w");
+    stream_info.symbolTable = &symbolTable;
+
+    SimulateProgramStart(stream_info.file);
+    ParseStream(pci, SimulateStatement, &stream_info);
+    SimulateProgramEnd(stream_info.file);
+    fclose(stream_info.file);
+
+    symbolTable.Print();
+    symbolTable.Destroy();
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+// Strength Reduction //////////////////////////////////////////////////////////////
+
+// Rewrites the operations of the checked tree that have a number on the right into cheaper ones, for the backends
+// that generate their own code: the -run engines, -elf and -asm. For simulation.cpp g++ does the same to * and /,
+// even at -O0, and SimulateNode() writes x ^ k unrolled (see SimulatePowerStart()), so the printed tree and the
+// tree of -flat and -stream keep the operators of the source.
+// The operation keeps its children and the number child holds the parameter:
+// - x * 2^k becomes x SHIFT_LEFT k (a number on the left of * is moved to the right first)
+// - x / 2^k becomes x SHIFT_DIVIDE k, an arithmetic shift corrected to round toward zero
+// - x / d for any other d > 2 becomes x MAGIC_DIVIDE d, a multiply-high by the DivisionMagic of d
+// - x ^ k for k >= 0 becomes x CONST_POWER k, exponentiation by squaring unrolled into multiplies
+// Operate() gives the same values as the operations they replace, and none of them can fail.
+
+// The multiplier and shift of a signed division by a number d > 1: n / d is the high 32 bits of multiplier * n,
+// plus n when the multiplier is negative, shifted right by shift, plus 1 when n is negative (Hacker's Delight 10-1)
+struct DivisionMagic {
+    int multiplier;
+    int shift;
+};
+
+DivisionMagic MakeDivisionMagic(int d) {
+    const unsigned two31 = 0x80000000u;
+    unsigned ad = d, anc = two31 - 1 - two31 % ad; // |nc|, the largest n with n mod d = d - 1
+    unsigned q1 = two31 / anc, r1 = two31 - q1 * anc; // 2^p / |nc|
+    unsigned q2 = two31 / ad, r2 = two31 - q2 * ad; // 2^p / d
+    unsigned delta;
+    int p = 31;
+    do {
+        p++;
+        q1 *= 2;
+        r1 *= 2;
+        if (r1 >= anc) {
+            q1++;
+            r1 -= anc;
+        }
+        q2 *= 2;
+        r2 *= 2;
+        if (r2 >= ad) {
+            q2++;
+            r2 -= ad;
+        }
+        delta = ad - r2;
+    } while (q1 < delta || (q1 == delta && r1 == 0));
+
+    DivisionMagic magic = {(int) (q2 + 1), p - 32};
+    return magic;
+}
+
+int MagicDivide(int n, DivisionMagic magic) {
+    unsigned q = (long long) magic.multiplier * n >> 32;
+    if (magic.multiplier < 0) q += n;
+    return ((int) q >> magic.shift) + ((unsigned) n >> 31);
+}
+
+// n / 2^k for 0 < k < 31: the shift rounds down, so a negative n is moved up by 2^k - 1 first
+int ShiftDivide(int n, int k) {
+    return (n + (int) ((unsigned) (n >> 31) >> (32 - k))) >> k;
+}
+
+// The operators of ReduceStrength(), whose right operand is always a number
+bool IsReducedOper(TokenType oper) {
+    return oper == SHIFT_LEFT || oper == SHIFT_DIVIDE || oper == MAGIC_DIVIDE || oper == CONST_POWER;
+}
+
+// k if n is 2^k with 0 < k < 31, else 0
+int PowerOfTwo(int n) {
+    int k;
+    for (k = 1; k < 31; k++) if (n == 1 << k) return k;
+    return 0;
+}
+
+// Rewrites the operations in the statements from root on, see the top of the section
+void ReduceStrength(TreeNode *root) {
+    vector<TreeNode *> stack;
+    if (root) stack.push_back(root);
+
+    while (!stack.empty()) {
+        TreeNode *node = stack.back();
+        stack.pop_back();
+        if (node->sibling) stack.push_back(node->sibling);
+        int i;
+        for (i = 0; i < MAX_CHILDREN; i++) if (node->child[i]) stack.push_back(node->child[i]);
+        if (node->node_kind != OPER_NODE) continue;
+
+        // a number has nothing to evaluate, so the order of the operands of * does not matter
+        if (node->oper == TIMES && node->child[0]->node_kind == NUM_NODE) swap(node->child[0], node->child[1]);
+        TreeNode *num = node->child[1];
+        if (num->node_kind != NUM_NODE) continue;
+
+        int k = PowerOfTwo(num->num);
+        if (node->oper == TIMES && k) {
+            node->oper = SHIFT_LEFT;
+            num->num = k;
+        } else if (node->oper == DIVIDE && k) {
+            node->oper = SHIFT_DIVIDE;
+            num->num = k;
+        } else if (node->oper == DIVIDE && num->num > 2) node->oper = MAGIC_DIVIDE;
+        else if (node->oper == POWER && num->num >= 0) node->oper = CONST_POWER; // IntPow() handles exp < 0
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+// Interpreter /////////////////////////////////////////////////////////////////////
+
+// Runs the checked tree in the compiler, with the integer semantics of the generated code built by g++ (run.sh):
+// - ints are 32 bits and wrap around on overflow
+// - / truncates toward zero, dividing by 0 (or the smallest int by -1) stops the program with an error
+//   where the generated code would crash
+// - ^ is IntPow()
+// - a comparison gives 1 or 0, and a condition is true when it is not 0
+// - variables start at 0 and live in one array indexed by their slot (see AssignSlots())
+// - read and write show the same prompts and lines as the generated code, and read reads like cin >> int
+
+// The integer power, int_pow_code is the same function in the generated code.
+// A negative exponent gives 1 / base^-exp truncated toward zero, which is 0 unless base is 1 or -1 (or 0).
+int IntPow(int base, int exp) {
+    if (exp < 0) return base == 1 || base == -1 ? (exp % 2 ? base : 1) : 0;
+    unsigned result = 1, factor = base;
+    for (; exp; exp >>= 1, factor *= factor) if (exp & 1) result *= factor;
+    return result;
+}
+
+// Thrown when the program can not go on
+struct RunError {
+    int line_num;
+    const char *message;
+};
+
+// What a running program sees: its variables and its input and output
+struct RunState {
+    const Interner *names;
+    vector<int> memory; // the variables, by slot
+    FILE *in, *out;
+    bool input_failed; // like cin, once a read fails the later reads give 0
+
+    RunState(SymbolTable *symbolTable, FILE *_in, FILE *_out) {
+        names = symbolTable->names;
+        memory.assign(symbolTable->num_vars, 0);
+        in = _in;
+        out = _out;
+        input_failed = false;
+    }
+
+    // Skips white space and reads an optionally signed number. A number out of range gives the nearest int,
+    // and no number gives 0; both fail the input.
+    int ReadInt() {
+        if (input_failed) return 0;
+        int c;
+        do c = getc(in); while (c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f');
+
+        bool negative = c == '-';
+        if (c == '-' || c == '+') c = getc(in);
+        if (c < '0' || c > '9') {
+            if (c != EOF) ungetc(c, in);
+            input_failed = true;
+            return 0;
+        }
+
+        long long value = 0;
+        for (; c >= '0' && c <= '9'; c = getc(in)) if (value <= INT_MAX) value = value * 10 + (c - '0');
+        if (c != EOF) ungetc(c, in);
+        if (negative) value = -value;
+
+        if (value < INT_MIN || value > INT_MAX) {
+            input_failed = true;
+            return value < 0 ? INT_MIN : INT_MAX;
+        }
+        return value;
+    }
+};
+
+struct Interpreter {
+    RunState *state;
+    vector<pair<TreeNode *, int> > eval_stack; // see Evaluate()
+    vector<int> values;
+};
+
+// a / b, the line number is where the error is reported
+int Divide(int a, int b, int line_num) {
+    RunError error = {line_num, 0};
+    if (b == 0) error.message = "division by zero";
+    else if (b == -1 && a == INT_MIN) error.message = "division overflow";
+    if (error.message) throw error;
+    return a / b;
 }
 
-int main() {
-    CompilerInfo *ci = new CompilerInfo("input.txt", "output.txt", "debug.txt");
+int Operate(TreeNode *node, int a, int b) {
+    unsigned ua = a, ub = b;
+    switch (node->oper) {
+        case EQUAL:
+            return a == b;
+        case LESS_THAN:
+            return a < b;
+        case PLUS:
+            return ua + ub;
+        case MINUS:
+            return ua - ub;
+        case TIMES:
+            return ua * ub;
+        case DIVIDE:
+            return Divide(a, b, node->line_num);
+        case POWER:
+        case CONST_POWER:
+            return IntPow(a, b);
+        case SHIFT_LEFT:
+            return ua << b;
+        case SHIFT_DIVIDE:
+            return ShiftDivide(a, b);
+        case MAGIC_DIVIDE:
+            return a / b; // the division that it stands for, the multiplier is for the compiled code
+        default:
+            return 0;
+    }
+}
 
-    TreeNode *root = Parse(ci);
+// The value of an expression, found by a postorder traversal with the operands on a value stack
+int Evaluate(Interpreter *pi, TreeNode *expr) {
+    vector<pair<TreeNode *, int> > &stack = pi->eval_stack; // nodes with the index of their next operand
+    vector<int> &values = pi->values;
+    stack.clear();
+    values.clear();
+    stack.push_back(make_pair(expr, 0));
+
+    while (!stack.empty()) {
+        TreeNode *node = stack.back().first;
+        int i = stack.back().second;
+
+        if (node->node_kind == OPER_NODE && i < 2) {
+            stack.back().second++;
+            stack.push_back(make_pair(node->child[i], 0));
+            continue;
+        }
+        stack.pop_back();
+
+        if (node->node_kind == NUM_NODE) values.push_back(node->num);
+        else if (node->node_kind == ID_NODE) values.push_back(pi->state->memory[node->var->memloc]);
+        else {
+            int b = values.back();
+            values.pop_back();
+            values.back() = Operate(node, values.back(), b);
+        }
+    }
+    return values.back();
+}
 
-    // build symbol table and type check the using the tree
-    auto *symbolTable = new SymbolTable();
-    buildSymbolTable(symbolTable, root);
-    TypeCheck(root);
+// Runs the statements from root on. The stack holds the statement sequences being run, each entry is the next
+// statement of its sequence; a repeat stays on the stack while its body runs, with state 1 when the condition
+// is next.
+void Execute(Interpreter *pi, TreeNode *root) {
+    RunState *ps = pi->state;
+    struct RunFrame {
+        TreeNode *node;
+        int state;
+    };
+    vector<RunFrame> stack;
+    RunFrame frame = {root, 0};
+    stack.push_back(frame);
+
+    while (!stack.empty()) {
+        TreeNode *node = stack.back().node;
+        if (!node) {
+            stack.pop_back();
+            continue;
+        }
 
-    // print tree and the symbol table
-    PrintTree(root);
-    symbolTable->Print();
+        // most statements are done after this step, and their sequence goes on with the sibling
+        RunFrame next = {node->sibling, 0};
+        switch (node->node_kind) {
+            case IF_NODE: {
+                TreeNode *branch = Evaluate(pi, node->child[0]) ? node->child[1] : node->child[2];
+                stack.back() = next;
+                frame.node = branch;
+                if (branch) stack.push_back(frame);
+                break;
+            }
+            case REPEAT_NODE:
+                if (stack.back().state == 0) {
+                    stack.back().state = 1;
+                    frame.node = node->child[0];
+                    stack.push_back(frame);
+                } else if (Evaluate(pi, node->child[1])) stack.back() = next;
+                else stack.back().state = 0;
+                break;
+            case ASSIGN_NODE:
+                ps->memory[node->var->memloc] = Evaluate(pi, node->child[0]);
+                stack.back() = next;
+                break;
+            case READ_NODE:
+                fprintf(ps->out, "Enter %s: ", ps->names->Name(node->id));
+                fflush(ps->out);
+                ps->memory[node->var->memloc] = ps->ReadInt();
+                stack.back() = next;
+                break;
+            case WRITE_NODE: {
+                TreeNode *expr = node->child[0];
+                int value = Evaluate(pi, expr);
+                if (expr->node_kind == ID_NODE) fprintf(ps->out, "%s: %d\n", ps->names->Name(expr->id), value);
+                else fprintf(ps->out, "%d\n", value);
+                stack.back() = next;
+                break;
+            }
+            default:
+                stack.back() = next;
+                break;
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+// Bytecode ////////////////////////////////////////////////////////////////////////
+
+// The checked tree lowered for a stack machine, run with the semantics of the Interpreter section. An expression
+// pushes its operands and an operator replaces the top two values with its result; if and repeat become
+// conditional jumps; variables are RunState::memory slots. An instruction is an opcode word followed by its
+// operand words, and jump targets are word indices.
+
+enum OpCode {
+    OP_HALT,
+    OP_PUSH, // number
+    OP_LOAD, // slot
+    OP_STORE, // slot; pops the value
+    OP_ADD, OP_SUB, OP_MUL,
+    OP_DIV, // line number, for the errors
+    OP_POW, OP_LT, OP_EQ,
+    OP_JUMP, // target
+    OP_JUMP_IF_ZERO, // target; pops the condition
+    OP_READ, // slot, id
+    OP_WRITE_VAR, // id; pops the value
+    OP_WRITE, // pops the value
+    OP_SHL, OP_SHIFT_DIV, // k: the operators of ReduceStrength() on the top value
+    OP_MAGIC_DIV, // multiplier, shift
+    OP_POW_K, // k
+    NUM_OPCODES
+};
+
+const char *const OpCodeStr[NUM_OPCODES] = {
+        "halt", "push", "load", "store", "add", "sub", "mul", "div", "pow", "lt", "eq", "jump", "jump_if_zero",
+        "read", "write_var", "write", "shl", "shift_div", "magic_div", "pow_k"
+};
+
+const int op_num_operands[NUM_OPCODES] = {0, 1, 1, 1, 0, 0, 0, 1, 0, 0, 0, 1, 1, 2, 1, 0, 1, 1, 2, 1};
+const bool op_has_target[NUM_OPCODES] = {false, false, false, false, false, false, false, false, false, false, false,
+                                         true, true, false, false, false, false, false, false, false};
+
+struct Bytecode {
+    vector<int> code;
+    int depth, max_depth; // values on the stack while compiling, the most of them at any point
+
+    vector<pair<TreeNode *, int> > expr_stack; // see EmitExpr()
+
+    Bytecode() {
+        depth = max_depth = 0;
+    }
+
+    void Emit(OpCode op) {
+        code.push_back(op);
+    }
+
+    // Returns the index of the operand, for patching jump targets
+    int Emit(OpCode op, int operand) {
+        code.push_back(op);
+        code.push_back(operand);
+        return code.size() - 1;
+    }
+
+    void Push() {
+        if (++depth > max_depth) max_depth = depth;
+    }
+};
+
+OpCode OperOpCode(TokenType oper) {
+    switch (oper) {
+        case PLUS:
+            return OP_ADD;
+        case MINUS:
+            return OP_SUB;
+        case TIMES:
+            return OP_MUL;
+        case DIVIDE:
+            return OP_DIV;
+        case POWER:
+            return OP_POW;
+        case LESS_THAN:
+            return OP_LT;
+        default:
+            return OP_EQ;
+    }
+}
+
+// Emits the code that pushes the value of an expression, in the postorder of Evaluate(). The number on the right
+// of a reduced operator is an operand of its instruction.
+void EmitExpr(Bytecode *pbc, TreeNode *expr) {
+    vector<pair<TreeNode *, int> > &stack = pbc->expr_stack;
+    stack.clear();
+    stack.push_back(make_pair(expr, 0));
+
+    while (!stack.empty()) {
+        TreeNode *node = stack.back().first;
+        int i = stack.back().second;
+
+        if (node->node_kind == OPER_NODE && i < (IsReducedOper(node->oper) ? 1 : 2)) {
+            stack.back().second++;
+            stack.push_back(make_pair(node->child[i], 0));
+            continue;
+        }
+        stack.pop_back();
+
+        if (node->node_kind == NUM_NODE) {
+            pbc->Emit(OP_PUSH, node->num);
+            pbc->Push();
+        } else if (node->node_kind == ID_NODE) {
+            pbc->Emit(OP_LOAD, node->var->memloc);
+            pbc->Push();
+        } else if (IsReducedOper(node->oper)) {
+            int k = node->child[1]->num;
+            if (node->oper == SHIFT_LEFT) pbc->Emit(OP_SHL, k);
+            else if (node->oper == SHIFT_DIVIDE) pbc->Emit(OP_SHIFT_DIV, k);
+            else if (node->oper == CONST_POWER) pbc->Emit(OP_POW_K, k);
+            else {
+                DivisionMagic magic = MakeDivisionMagic(k);
+                pbc->Emit(OP_MAGIC_DIV, magic.multiplier);
+                pbc->code.push_back(magic.shift);
+            }
+        } else {
+            OpCode op = OperOpCode(node->oper);
+            if (op == OP_DIV) pbc->Emit(op, node->line_num);
+            else pbc->Emit(op);
+            pbc->depth--;
+        }
+    }
+    pbc->depth--;
+}
+
+// Compiles the statements from root on, with the frames of Execute(): an if stays on the stack while its
+// branches are compiled (state 1 after the then part, 2 after the else part) with the jump to patch in label,
+// and a repeat while its body is compiled (state 1) with the start of the body in label.
+void CompileProgram(Bytecode *pbc, TreeNode *root) {
+    struct CodeFrame {
+        TreeNode *node;
+        int state;
+        int label;
+    };
+    vector<CodeFrame> stack;
+    CodeFrame frame = {root, 0, 0};
+    stack.push_back(frame);
+
+    while (!stack.empty()) {
+        CodeFrame *pf = &stack.back();
+        TreeNode *node = pf->node;
+        if (!node) {
+            stack.pop_back();
+            continue;
+        }
+
+        CodeFrame next = {node->sibling, 0, 0};
+        int here = pbc->code.size();
+        switch (node->node_kind) {
+            case IF_NODE:
+                if (pf->state == 0) {
+                    EmitExpr(pbc, node->child[0]);
+                    pf->label = pbc->Emit(OP_JUMP_IF_ZERO, 0);
+                    pf->state = 1;
+                    frame.node = node->child[1];
+                    stack.push_back(frame);
+                } else if (pf->state == 1 && node->child[2]) {
+                    int jump = pbc->Emit(OP_JUMP, 0);
+                    pbc->code[pf->label] = jump + 1;
+                    pf->label = jump;
+                    pf->state = 2;
+                    frame.node = node->child[2];
+                    stack.push_back(frame);
+                } else {
+                    pbc->code[pf->label] = here;
+                    *pf = next;
+                }
+                break;
+            case REPEAT_NODE:
+                if (pf->state == 0) {
+                    pf->label = here;
+                    pf->state = 1;
+                    frame.node = node->child[0];
+                    stack.push_back(frame);
+                } else {
+                    EmitExpr(pbc, node->child[1]);
+                    pbc->Emit(OP_JUMP_IF_ZERO, pf->label);
+                    *pf = next;
+                }
+                break;
+            case ASSIGN_NODE:
+                EmitExpr(pbc, node->child[0]);
+                pbc->Emit(OP_STORE, node->var->memloc);
+                *pf = next;
+                break;
+            case READ_NODE:
+                pbc->Emit(OP_READ, node->var->memloc);
+                pbc->code.push_back(node->id);
+                *pf = next;
+                break;
+            case WRITE_NODE: {
+                TreeNode *expr = node->child[0];
+                EmitExpr(pbc, expr);
+                if (expr->node_kind == ID_NODE) pbc->Emit(OP_WRITE_VAR, expr->id);
+                else pbc->Emit(OP_WRITE);
+                *pf = next;
+                break;
+            }
+            default:
+                *pf = next;
+                break;
+        }
+    }
+    pbc->Emit(OP_HALT);
+}
+
+// A word of the code that the VMs run: the address of the code of an opcode (direct threading), or the opcode for
+// the switch when the compiler can not take label addresses, an operand, or a jump target.
+union VmWord {
+    const void *label;
+    int opcode;
+    int operand;
+    VmWord *target;
+};
+
+// Threads the code for a VM: each opcode becomes the address of its code (labels) so an instruction ends by
+// jumping straight to the next one, and jump targets, the last operand of the jumps, become pointers.
+void ThreadCode(const vector<int> &code, const int *num_operands, const bool *has_target,
+                const void *const *labels, vector<VmWord> *words) {
+    words->resize(code.size());
+    size_t i, j;
+    for (i = 0; i < code.size(); i += 1 + num_operands[code[i]]) {
+        int op = code[i];
+#ifdef TINY_HAVE_COMPUTED_GOTO
+        (*words)[i].label = labels[op];
+#else
+        (*words)[i].opcode = op;
+        (void) labels;
+#endif
+        for (j = 1; j <= (size_t) num_operands[op]; j++) (*words)[i + j].operand = code[i + j];
+        if (has_target[op]) (*words)[i + j - 1].target = &(*words)[code[i + j - 1]];
+    }
+}
+
+// Dispatch counts, compiled in with g++ -DTINY_VM_STATS=1 and shown on stderr after the program: every opcode,
+// and the pairs of opcodes that run one after the other, which are the candidates for superinstructions.
+#ifndef TINY_VM_STATS
+#define TINY_VM_STATS 0
+#endif
+
+#if TINY_VM_STATS
+#define VM_STATS_MAX_OPCODES 64
+
+struct DispatchStats {
+    unsigned long long count[VM_STATS_MAX_OPCODES];
+    unsigned long long pairs[VM_STATS_MAX_OPCODES][VM_STATS_MAX_OPCODES];
+    int last;
+
+    void Count(int op) {
+        count[op]++;
+        pairs[last][op]++;
+        last = op;
+    }
+
+    // Prints the counts of the opcodes and of the most frequent pairs, largest first
+    void Print(const char *const *names, int num_opcodes) {
+        vector<pair<unsigned long long, int> > order;
+        unsigned long long total = 0;
+        int i, j;
+        for (i = 0; i < num_opcodes; i++) {
+            total += count[i];
+            if (count[i]) order.push_back(make_pair(count[i], i));
+        }
+        fprintf(stderr, "Dispatches: %llu\n", total);
+        sort(order.rbegin(), order.rend());
+        for (i = 0; i < (int) order.size(); i++) fprintf(stderr, "%12llu %s\n", order[i].first, names[order[i].second]);
+
+        order.clear();
+        for (i = 0; i < num_opcodes; i++)
+            for (j = 0; j < num_opcodes; j++) if (pairs[i][j]) order.push_back(make_pair(pairs[i][j], i * 256 + j));
+        sort(order.rbegin(), order.rend());
+        fprintf(stderr, "Pairs:\n");
+        for (i = 0; i < (int) order.size() && i < 16; i++)
+            fprintf(stderr, "%12llu %s %s\n", order[i].first, names[order[i].second / 256],
+                    names[order[i].second % 256]);
+    }
+};
+
+DispatchStats vm_stats;
+
+#define VM_COUNT(op) vm_stats.Count(op)
+#else
+#define VM_COUNT(op)
+#endif
+
+// The dispatch of a VM that runs VmWords from pc, the same code with computed goto or a switch
+#ifdef TINY_HAVE_COMPUTED_GOTO
+#define VM_CASE(op) label_##op: VM_COUNT(op);
+#define VM_NEXT() goto *(pc++)->label
+#define VM_DISPATCH() VM_NEXT();
+#else
+#define VM_CASE(op) case op: VM_COUNT(op);
+#define VM_NEXT() break
+#define VM_DISPATCH() for (;;) switch ((pc++)->opcode)
+#endif
+
+// Runs the code until OP_HALT
+void RunBytecode(RunState *ps, const Bytecode *pbc) {
+#ifdef TINY_HAVE_COMPUTED_GOTO
+    static const void *const labels[NUM_OPCODES] = {
+            &&label_OP_HALT, &&label_OP_PUSH, &&label_OP_LOAD, &&label_OP_STORE, &&label_OP_ADD, &&label_OP_SUB,
+            &&label_OP_MUL, &&label_OP_DIV, &&label_OP_POW, &&label_OP_LT, &&label_OP_EQ, &&label_OP_JUMP,
+            &&label_OP_JUMP_IF_ZERO, &&label_OP_READ, &&label_OP_WRITE_VAR, &&label_OP_WRITE, &&label_OP_SHL,
+            &&label_OP_SHIFT_DIV, &&label_OP_MAGIC_DIV, &&label_OP_POW_K
+    };
+#else
+    const void *const *labels = 0;
+#endif
+    vector<VmWord> words;
+    ThreadCode(pbc->code, op_num_operands, op_has_target, labels, &words);
+
+    vector<int> stack(pbc->max_depth + 1);
+    int *sp = &stack[0]; // the top value is sp[-1]
+    int *memory = ps->memory.data();
+    FILE *out = ps->out;
+    VmWord *pc = &words[0];
+
+    VM_DISPATCH() {
+        VM_CASE(OP_HALT)
+            return;
+        VM_CASE(OP_PUSH)
+            *sp++ = (pc++)->operand;
+            VM_NEXT();
+        VM_CASE(OP_LOAD)
+            *sp++ = memory[(pc++)->operand];
+            VM_NEXT();
+        VM_CASE(OP_STORE)
+            memory[(pc++)->operand] = *--sp;
+            VM_NEXT();
+        VM_CASE(OP_ADD)
+            sp--;
+            sp[-1] = (unsigned) sp[-1] + (unsigned) sp[0];
+            VM_NEXT();
+        VM_CASE(OP_SUB)
+            sp--;
+            sp[-1] = (unsigned) sp[-1] - (unsigned) sp[0];
+            VM_NEXT();
+        VM_CASE(OP_MUL)
+            sp--;
+            sp[-1] = (unsigned) sp[-1] * (unsigned) sp[0];
+            VM_NEXT();
+        VM_CASE(OP_DIV)
+            sp--;
+            sp[-1] = Divide(sp[-1], sp[0], (pc++)->operand);
+            VM_NEXT();
+        VM_CASE(OP_POW)
+            sp--;
+            sp[-1] = IntPow(sp[-1], sp[0]);
+            VM_NEXT();
+        VM_CASE(OP_LT)
+            sp--;
+            sp[-1] = sp[-1] < sp[0];
+            VM_NEXT();
+        VM_CASE(OP_EQ)
+            sp--;
+            sp[-1] = sp[-1] == sp[0];
+            VM_NEXT();
+        VM_CASE(OP_JUMP)
+            pc = pc->target;
+            VM_NEXT();
+        VM_CASE(OP_JUMP_IF_ZERO)
+            pc = *--sp ? pc + 1 : pc->target;
+            VM_NEXT();
+        VM_CASE(OP_READ)
+            fprintf(out, "Enter %s: ", ps->names->Name(pc[1].operand));
+            fflush(out);
+            memory[pc[0].operand] = ps->ReadInt();
+            pc += 2;
+            VM_NEXT();
+        VM_CASE(OP_WRITE_VAR)
+            fprintf(out, "%s: %d\n", ps->names->Name((pc++)->operand), *--sp);
+            VM_NEXT();
+        VM_CASE(OP_WRITE)
+            fprintf(out, "%d\n", *--sp);
+            VM_NEXT();
+        VM_CASE(OP_SHL)
+            sp[-1] = (unsigned) sp[-1] << (pc++)->operand;
+            VM_NEXT();
+        VM_CASE(OP_SHIFT_DIV)
+            sp[-1] = ShiftDivide(sp[-1], (pc++)->operand);
+            VM_NEXT();
+        VM_CASE(OP_MAGIC_DIV) {
+            DivisionMagic magic = {pc[0].operand, pc[1].operand};
+            sp[-1] = MagicDivide(sp[-1], magic);
+            pc += 2;
+            VM_NEXT();
+        }
+        VM_CASE(OP_POW_K)
+            sp[-1] = IntPow(sp[-1], (pc++)->operand);
+            VM_NEXT();
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+// Register Machine ////////////////////////////////////////////////////////////////
+
+// The checked tree lowered for a register machine, run with the semantics of the Interpreter section. The
+// registers are RunState::memory: one per variable, its slot, then the temporaries of the expressions. An
+// instruction names its destination and operand registers, an operand that is a number is an immediate (the _K
+// opcodes), and a condition becomes a compare-and-branch. An instruction is an opcode word followed by its
+// operand words; the jump target, a word index, is the last operand.
+// The superinstructions fuse pairs that run often (see TINY_VM_STATS): the counter update and the test that end a
+// loop, and a product added to a value.
+
+enum RegOpCode {
+    ROP_HALT,
+    ROP_SET, // d, number
+    ROP_MOVE, // d, a
+    ROP_ADD, ROP_SUB, ROP_MUL, // d, a, b
+    ROP_DIV, // d, a, b, line number
+    ROP_POW, ROP_LT, ROP_EQ, // d, a, b
+    ROP_ADD_K, ROP_SUB_K, ROP_MUL_K, // d, a, number
+    ROP_DIV_K, // d, a, number that is not 0 or -1
+    ROP_RSUB_K, // d, number, a: d = number - a
+    ROP_JUMP, // target
+    ROP_JUMP_ZERO, // a, target
+    ROP_JUMP_GE, ROP_JUMP_NE, // a, b, target: jump if a >= b, a != b
+    ROP_JUMP_GE_K, ROP_JUMP_LE_K, ROP_JUMP_NE_K, // a, number, target
+    ROP_READ, // d, id
+    ROP_WRITE_VAR, // a, id
+    ROP_WRITE, // a
+    ROP_DEC_JUMP_NZ, // d, target: d = d - 1, jump if d != 0
+    ROP_INC_JUMP_NE, // d, b, target: d = d + 1, jump if d != b
+    ROP_INC_JUMP_NE_K, ROP_INC_JUMP_LE_K, // d, number, target: d = d + 1, jump if d != number, d <= number
+    ROP_MUL_ADD, // d, a, b, c: d = a + b * c
+    ROP_SHL_K, ROP_SHIFT_DIV_K, ROP_POW_K, // d, a, k: the operators of ReduceStrength()
+    ROP_MAGIC_DIV, // d, a, multiplier, shift
+    NUM_REG_OPCODES
+};
+
+const char *const RegOpCodeStr[NUM_REG_OPCODES] = {
+        "halt", "set", "move", "add", "sub", "mul", "div", "pow", "lt", "eq", "add_k", "sub_k", "mul_k", "div_k",
+        "rsub_k", "jump", "jump_zero", "jump_ge", "jump_ne", "jump_ge_k", "jump_le_k", "jump_ne_k", "read",
+        "write_var", "write", "dec_jump_nz", "inc_jump_ne", "inc_jump_ne_k", "inc_jump_le_k", "mul_add", "shl_k",
+        "shift_div_k", "pow_k", "magic_div"
+};
+
+const int rop_num_operands[NUM_REG_OPCODES] = {0, 2, 2, 3, 3, 3, 4, 3, 3, 3, 3, 3, 3, 3, 3, 1, 2, 3, 3, 3, 3, 3,
+                                               2, 2, 1, 2, 3, 3, 3, 4, 3, 3, 3, 4};
+const bool rop_has_target[NUM_REG_OPCODES] = {false, false, false, false, false, false, false, false, false, false,
+                                              false, false, false, false, false, true, true, true, true, true, true,
+                                              true, false, false, false, true, true, true, true, false, false,
+                                              false, false, false};
+
+// Where a value is: a register, or a number known when compiling
+struct RegOperand {
+    bool is_num;
+    int value;
+};
+
+struct RegCode {
+    vector<int> code;
+    int num_vars;
+    int num_temps; // registers after the variables used by the expressions
+    int last; // the start of the last instruction, -1 if none
+    int label; // the last jump target, the instruction there must not be fused with the one before it
+
+    vector<pair<TreeNode *, int> > expr_stack; // see EmitRegExpr()
+    vector<RegOperand> values;
+
+    explicit RegCode(int _num_vars) {
+        num_vars = _num_vars;
+        num_temps = 0;
+        last = label = -1;
+    }
+
+    // Returns the index of the last operand, the target of a jump
+    int Emit(RegOpCode op, int a = 0, int b = 0, int c = 0, int d = 0) {
+        int operands[4] = {a, b, c, d};
+        last = code.size();
+        code.push_back(op);
+        code.insert(code.end(), operands, operands + rop_num_operands[op]);
+        return code.size() - 1;
+    }
+
+    // The position of the next instruction as a jump target
+    int Label() {
+        label = code.size();
+        return label;
+    }
+
+    void Patch(int target_index) {
+        if (target_index >= 0) code[target_index] = Label();
+    }
+
+    // The last instruction if it is op and the next one may be fused with it, else 0. The instruction is at
+    // code[last], its operands follow it.
+    const int *LastIs(RegOpCode op) {
+        if (last < 0 || label == (int) code.size() || code[last] != op) return 0;
+        return &code[last];
+    }
+
+    // The temporary register for the value at depth i of an expression
+    int Temp(int i) {
+        if (i + 1 > num_temps) num_temps = i + 1;
+        return num_vars + i;
+    }
+};
+
+// Puts a number in a register
+int MaterializeOperand(RegCode *prc, RegOperand operand, int temp) {
+    if (!operand.is_num) return operand.value;
+    prc->Emit(ROP_SET, temp, operand.value);
+    return temp;
+}
+
+// Emits node's operation of a and b into register d, or folds it into a number. The operands are at depth i and
+// i + 1 of the expression, whose temporaries may be used.
+RegOperand EmitOper(RegCode *prc, TreeNode *node, int d, RegOperand a, RegOperand b, int i) {
+    TokenType oper = node->oper;
+    RegOperand result = {false, d};
+
+    if (a.is_num && b.is_num && !(oper == DIVIDE && (b.value == 0 || (b.value == -1 && a.value == INT_MIN)))) {
+        result.is_num = true;
+        result.value = Operate(node, a.value, b.value);
+        return result;
+    }
+
+    // a reduced operator has its number on the right, and a is a register since two numbers were folded
+    if (oper == SHIFT_LEFT) prc->Emit(ROP_SHL_K, d, a.value, b.value);
+    else if (oper == SHIFT_DIVIDE) prc->Emit(ROP_SHIFT_DIV_K, d, a.value, b.value);
+    else if (oper == CONST_POWER) prc->Emit(ROP_POW_K, d, a.value, b.value);
+    else if (oper == MAGIC_DIVIDE) {
+        DivisionMagic magic = MakeDivisionMagic(b.value);
+        prc->Emit(ROP_MAGIC_DIV, d, a.value, magic.multiplier, magic.shift);
+    }
+    if (IsReducedOper(oper)) return result;
+
+    // the number on the right of + * and =
+    if (a.is_num && (oper == PLUS || oper == TIMES || oper == EQUAL)) swap(a, b);
+
+    if (a.is_num && oper == MINUS) prc->Emit(ROP_RSUB_K, d, a.value, b.value);
+    else if (b.is_num && oper == PLUS) prc->Emit(ROP_ADD_K, d, a.value, b.value);
+    else if (b.is_num && oper == MINUS) prc->Emit(ROP_SUB_K, d, a.value, b.value);
+    else if (b.is_num && oper == TIMES) prc->Emit(ROP_MUL_K, d, a.value, b.value);
+    else if (b.is_num && oper == DIVIDE && b.value != 0 && b.value != -1 && !a.is_num)
+        prc->Emit(ROP_DIV_K, d, a.value, b.value);
+    else {
+        int ra = MaterializeOperand(prc, a, prc->Temp(i));
+        int rb = MaterializeOperand(prc, b, prc->Temp(i + 1));
+        const int *mul = prc->LastIs(ROP_MUL);
+        switch (oper) {
+            case PLUS:
+                // a + b * c, when the product is in a temporary that is not used again
+                if (mul && ra == mul[1] && ra >= prc->num_vars) swap(ra, rb);
+                if (mul && rb == mul[1] && rb >= prc->num_vars) {
+                    int mb = mul[2], mc = mul[3];
+                    prc->code.resize(prc->last);
+                    prc->Emit(ROP_MUL_ADD, d, ra, mb, mc);
+                } else prc->Emit(ROP_ADD, d, ra, rb);
+                break;
+            case MINUS:
+                prc->Emit(ROP_SUB, d, ra, rb);
+                break;
+            case TIMES:
+                prc->Emit(ROP_MUL, d, ra, rb);
+                break;
+            case DIVIDE:
+                prc->Emit(ROP_DIV, d, ra, rb, node->line_num);
+                break;
+            case POWER:
+                prc->Emit(ROP_POW, d, ra, rb);
+                break;
+            case LESS_THAN:
+                prc->Emit(ROP_LT, d, ra, rb);
+                break;
+            default:
+                prc->Emit(ROP_EQ, d, ra, rb);
+                break;
+        }
+    }
+    return result;
+}
+
+// Emits the code of an expression whose values start at depth base, in the postorder of Evaluate(), and returns
+// where its value is. The root operation writes register d when d >= 0, a temporary otherwise.
+RegOperand EmitRegExpr(RegCode *prc, TreeNode *expr, int d, int base) {
+    vector<pair<TreeNode *, int> > &stack = prc->expr_stack;
+    vector<RegOperand> &values = prc->values;
+    stack.clear();
+    values.clear();
+    stack.push_back(make_pair(expr, 0));
+
+    while (!stack.empty()) {
+        TreeNode *node = stack.back().first;
+        int i = stack.back().second;
+
+        if (node->node_kind == OPER_NODE && i < 2) {
+            stack.back().second++;
+            stack.push_back(make_pair(node->child[i], 0));
+            continue;
+        }
+        stack.pop_back();
+
+        RegOperand value = {node->node_kind == NUM_NODE, 0};
+        if (node->node_kind == NUM_NODE) value.value = node->num;
+        else if (node->node_kind == ID_NODE) value.value = node->var->memloc;
+        else {
+            RegOperand b = values.back();
+            values.pop_back();
+            RegOperand a = values.back();
+            values.pop_back();
+            int depth = base + values.size();
+            value = EmitOper(prc, node, stack.empty() && d >= 0 ? d : prc->Temp(depth), a, b, depth);
+        }
+        values.push_back(value);
+    }
+    return values.back();
+}
+
+// Emits a jump to target when the condition is false, and returns the index of the target to patch, or -1 when
+// the condition is always true and nothing was emitted.
+int EmitJumpIfFalse(RegCode *prc, TreeNode *cond, int target) {
+    if (cond->node_kind != OPER_NODE || (cond->oper != LESS_THAN && cond->oper != EQUAL)) {
+        RegOperand value = EmitRegExpr(prc, cond, -1, 0);
+        if (value.is_num) return value.value ? -1 : prc->Emit(ROP_JUMP, target);
+        return prc->Emit(ROP_JUMP_ZERO, value.value, target);
+    }
+
+    RegOperand a = EmitRegExpr(prc, cond->child[0], -1, 0);
+    RegOperand b = EmitRegExpr(prc, cond->child[1], -1, 1);
+    bool less = cond->oper == LESS_THAN;
+    if (a.is_num && b.is_num) {
+        bool value = less ? a.value < b.value : a.value == b.value;
+        return value ? -1 : prc->Emit(ROP_JUMP, target);
+    }
+
+    // the counter of a loop, updated right before its test
+    const int *inc = prc->LastIs(ROP_ADD_K), *dec = prc->LastIs(ROP_SUB_K);
+
+    if (!a.is_num && !b.is_num) {
+        if (!less && inc && inc[2] == inc[1] && inc[3] == 1 && (inc[1] == a.value || inc[1] == b.value)) {
+            if (inc[1] == b.value) swap(a, b);
+            prc->code.resize(prc->last);
+            return prc->Emit(ROP_INC_JUMP_NE, a.value, b.value, target);
+        }
+        return prc->Emit(less ? ROP_JUMP_GE : ROP_JUMP_NE, a.value, b.value, target);
+    }
+
+    // a register and a number: jump if not (a < k), not (k < a), or a != k
+    RegOpCode op = less ? (b.is_num ? ROP_JUMP_GE_K : ROP_JUMP_LE_K) : ROP_JUMP_NE_K;
+    if (a.is_num) swap(a, b);
+    int k = b.value;
+
+    if (dec && op == ROP_JUMP_NE_K && k == 0 && dec[1] == a.value && dec[2] == a.value && dec[3] == 1) {
+        prc->code.resize(prc->last);
+        return prc->Emit(ROP_DEC_JUMP_NZ, a.value, target);
+    }
+    if (inc && (op == ROP_JUMP_NE_K || op == ROP_JUMP_LE_K) && inc[1] == a.value && inc[2] == a.value &&
+        inc[3] == 1) {
+        prc->code.resize(prc->last);
+        return prc->Emit(op == ROP_JUMP_NE_K ? ROP_INC_JUMP_NE_K : ROP_INC_JUMP_LE_K, a.value, k, target);
+    }
+    return prc->Emit(op, a.value, k, target);
+}
+
+// Compiles the statements from root on, with the frames of CompileProgram()
+void CompileRegProgram(RegCode *prc, TreeNode *root) {
+    struct CodeFrame {
+        TreeNode *node;
+        int state;
+        int label;
+    };
+    vector<CodeFrame> stack;
+    CodeFrame frame = {root, 0, 0};
+    stack.push_back(frame);
+
+    while (!stack.empty()) {
+        CodeFrame *pf = &stack.back();
+        TreeNode *node = pf->node;
+        if (!node) {
+            stack.pop_back();
+            continue;
+        }
+
+        CodeFrame next = {node->sibling, 0, 0};
+        switch (node->node_kind) {
+            case IF_NODE:
+                if (pf->state == 0) {
+                    pf->label = EmitJumpIfFalse(prc, node->child[0], 0);
+                    pf->state = 1;
+                    frame.node = node->child[1];
+                    stack.push_back(frame);
+                } else if (pf->state == 1 && node->child[2]) {
+                    int jump = prc->Emit(ROP_JUMP, 0);
+                    prc->Patch(pf->label);
+                    pf->label = jump;
+                    pf->state = 2;
+                    frame.node = node->child[2];
+                    stack.push_back(frame);
+                } else {
+                    prc->Patch(pf->label);
+                    *pf = next;
+                }
+                break;
+            case REPEAT_NODE:
+                if (pf->state == 0) {
+                    pf->label = prc->Label();
+                    pf->state = 1;
+                    frame.node = node->child[0];
+                    stack.push_back(frame);
+                } else {
+                    EmitJumpIfFalse(prc, node->child[1], pf->label);
+                    *pf = next;
+                }
+                break;
+            case ASSIGN_NODE: {
+                int d = node->var->memloc;
+                RegOperand value = EmitRegExpr(prc, node->child[0], d, 0);
+                if (value.is_num) prc->Emit(ROP_SET, d, value.value);
+                else if (value.value != d) prc->Emit(ROP_MOVE, d, value.value);
+                *pf = next;
+                break;
+            }
+            case READ_NODE:
+                prc->Emit(ROP_READ, node->var->memloc, node->id);
+                *pf = next;
+                break;
+            case WRITE_NODE: {
+                TreeNode *expr = node->child[0];
+                int a = MaterializeOperand(prc, EmitRegExpr(prc, expr, -1, 0), prc->Temp(0));
+                if (expr->node_kind == ID_NODE) prc->Emit(ROP_WRITE_VAR, a, expr->id);
+                else prc->Emit(ROP_WRITE, a);
+                *pf = next;
+                break;
+            }
+            default:
+                *pf = next;
+                break;
+        }
+    }
+    prc->Emit(ROP_HALT);
+}
+
+// Runs the code until ROP_HALT, in the registers of ps
+void RunRegisters(RunState *ps, const RegCode *prc) {
+#ifdef TINY_HAVE_COMPUTED_GOTO
+    static const void *const labels[NUM_REG_OPCODES] = {
+            &&label_ROP_HALT, &&label_ROP_SET, &&label_ROP_MOVE, &&label_ROP_ADD, &&label_ROP_SUB, &&label_ROP_MUL,
+            &&label_ROP_DIV, &&label_ROP_POW, &&label_ROP_LT, &&label_ROP_EQ, &&label_ROP_ADD_K, &&label_ROP_SUB_K,
+            &&label_ROP_MUL_K, &&label_ROP_DIV_K, &&label_ROP_RSUB_K, &&label_ROP_JUMP, &&label_ROP_JUMP_ZERO,
+            &&label_ROP_JUMP_GE, &&label_ROP_JUMP_NE, &&label_ROP_JUMP_GE_K, &&label_ROP_JUMP_LE_K,
+            &&label_ROP_JUMP_NE_K, &&label_ROP_READ, &&label_ROP_WRITE_VAR, &&label_ROP_WRITE,
+            &&label_ROP_DEC_JUMP_NZ, &&label_ROP_INC_JUMP_NE, &&label_ROP_INC_JUMP_NE_K, &&label_ROP_INC_JUMP_LE_K,
+            &&label_ROP_MUL_ADD, &&label_ROP_SHL_K, &&label_ROP_SHIFT_DIV_K, &&label_ROP_POW_K, &&label_ROP_MAGIC_DIV
+    };
+#else
+    const void *const *labels = 0;
+#endif
+    vector<VmWord> words;
+    ThreadCode(prc->code, rop_num_operands, rop_has_target, labels, &words);
+
+    ps->memory.resize(prc->num_vars + prc->num_temps);
+    int *reg = ps->memory.data();
+    FILE *out = ps->out;
+    VmWord *pc = &words[0];
+
+// the operands of the instruction from pc: registers, numbers
+#define R(i) reg[pc[i].operand]
+#define K(i) pc[i].operand
+#define U(x) ((unsigned) (x))
+
+    VM_DISPATCH() {
+        VM_CASE(ROP_HALT)
+            return;
+        VM_CASE(ROP_SET)
+            R(0) = K(1);
+            pc += 2;
+            VM_NEXT();
+        VM_CASE(ROP_MOVE)
+            R(0) = R(1);
+            pc += 2;
+            VM_NEXT();
+        VM_CASE(ROP_ADD)
+            R(0) = U(R(1)) + U(R(2));
+            pc += 3;
+            VM_NEXT();
+        VM_CASE(ROP_SUB)
+            R(0) = U(R(1)) - U(R(2));
+            pc += 3;
+            VM_NEXT();
+        VM_CASE(ROP_MUL)
+            R(0) = U(R(1)) * U(R(2));
+            pc += 3;
+            VM_NEXT();
+        VM_CASE(ROP_DIV)
+            R(0) = Divide(R(1), R(2), K(3));
+            pc += 4;
+            VM_NEXT();
+        VM_CASE(ROP_POW)
+            R(0) = IntPow(R(1), R(2));
+            pc += 3;
+            VM_NEXT();
+        VM_CASE(ROP_LT)
+            R(0) = R(1) < R(2);
+            pc += 3;
+            VM_NEXT();
+        VM_CASE(ROP_EQ)
+            R(0) = R(1) == R(2);
+            pc += 3;
+            VM_NEXT();
+        VM_CASE(ROP_ADD_K)
+            R(0) = U(R(1)) + U(K(2));
+            pc += 3;
+            VM_NEXT();
+        VM_CASE(ROP_SUB_K)
+            R(0) = U(R(1)) - U(K(2));
+            pc += 3;
+            VM_NEXT();
+        VM_CASE(ROP_MUL_K)
+            R(0) = U(R(1)) * U(K(2));
+            pc += 3;
+            VM_NEXT();
+        VM_CASE(ROP_DIV_K)
+            R(0) = R(1) / K(2);
+            pc += 3;
+            VM_NEXT();
+        VM_CASE(ROP_RSUB_K)
+            R(0) = U(K(1)) - U(R(2));
+            pc += 3;
+            VM_NEXT();
+        VM_CASE(ROP_JUMP)
+            pc = pc[0].target;
+            VM_NEXT();
+        VM_CASE(ROP_JUMP_ZERO)
+            pc = R(0) == 0 ? pc[1].target : pc + 2;
+            VM_NEXT();
+        VM_CASE(ROP_JUMP_GE)
+            pc = R(0) >= R(1) ? pc[2].target : pc + 3;
+            VM_NEXT();
+        VM_CASE(ROP_JUMP_NE)
+            pc = R(0) != R(1) ? pc[2].target : pc + 3;
+            VM_NEXT();
+        VM_CASE(ROP_JUMP_GE_K)
+            pc = R(0) >= K(1) ? pc[2].target : pc + 3;
+            VM_NEXT();
+        VM_CASE(ROP_JUMP_LE_K)
+            pc = R(0) <= K(1) ? pc[2].target : pc + 3;
+            VM_NEXT();
+        VM_CASE(ROP_JUMP_NE_K)
+            pc = R(0) != K(1) ? pc[2].target : pc + 3;
+            VM_NEXT();
+        VM_CASE(ROP_READ)
+            fprintf(out, "Enter %s: ", ps->names->Name(K(1)));
+            fflush(out);
+            R(0) = ps->ReadInt();
+            pc += 2;
+            VM_NEXT();
+        VM_CASE(ROP_WRITE_VAR)
+            fprintf(out, "%s: %d\n", ps->names->Name(K(1)), R(0));
+            pc += 2;
+            VM_NEXT();
+        VM_CASE(ROP_WRITE)
+            fprintf(out, "%d\n", R(0));
+            pc += 1;
+            VM_NEXT();
+        VM_CASE(ROP_DEC_JUMP_NZ)
+            R(0) = U(R(0)) - 1;
+            pc = R(0) != 0 ? pc[1].target : pc + 2;
+            VM_NEXT();
+        VM_CASE(ROP_INC_JUMP_NE)
+            R(0) = U(R(0)) + 1;
+            pc = R(0) != R(1) ? pc[2].target : pc + 3;
+            VM_NEXT();
+        VM_CASE(ROP_INC_JUMP_NE_K)
+            R(0) = U(R(0)) + 1;
+            pc = R(0) != K(1) ? pc[2].target : pc + 3;
+            VM_NEXT();
+        VM_CASE(ROP_INC_JUMP_LE_K)
+            R(0) = U(R(0)) + 1;
+            pc = R(0) <= K(1) ? pc[2].target : pc + 3;
+            VM_NEXT();
+        VM_CASE(ROP_MUL_ADD)
+            R(0) = U(R(1)) + U(R(2)) * U(R(3));
+            pc += 4;
+            VM_NEXT();
+        VM_CASE(ROP_SHL_K)
+            R(0) = U(R(1)) << K(2);
+            pc += 3;
+            VM_NEXT();
+        VM_CASE(ROP_SHIFT_DIV_K)
+            R(0) = ShiftDivide(R(1), K(2));
+            pc += 3;
+            VM_NEXT();
+        VM_CASE(ROP_POW_K)
+            R(0) = IntPow(R(1), K(2));
+            pc += 3;
+            VM_NEXT();
+        VM_CASE(ROP_MAGIC_DIV) {
+            DivisionMagic magic = {K(2), K(3)};
+            R(0) = MagicDivide(R(1), magic);
+            pc += 4;
+            VM_NEXT();
+        }
+    }
+
+#undef R
+#undef K
+#undef U
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+// JIT /////////////////////////////////////////////////////////////////////////////
+
+// The checked tree compiled to x86-64 code, with the semantics of the Interpreter section, that the JIT calls in
+// memory (or that is written in an executable, see the ELF section). The code is one function
+// int (int *memory, JitContext *ctx) (System V calling convention) that returns 0, or 1 after a division error.
+// The variables stay in memory at rbx + 4 * slot. The values of an expression are immediates, variables, or
+// registers: the value at depth i is in jit_regs[i], and the deeper ones in the memory temporaries after the
+// variables. read, write, ^ and the errors call helpers.
+
+enum JitReg {RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15};
+
+// The caller saved registers for the values of expressions. RAX and RDX are used by idiv and the calls, R11 is a
+// scratch register, RBX holds memory and R12 the context.
+const JitReg jit_regs[] = {RCX, RSI, RDI, R8, R9, R10};
+#define JIT_NUM_REGS 6
+
+// Condition codes of jcc and setcc
+enum JitCond {
+    JIT_B = 0x2, JIT_E = 0x4, JIT_NE = 0x5, JIT_BE = 0x6, JIT_S = 0x8, JIT_NS = 0x9, JIT_L = 0xc, JIT_GE = 0xd,
+    JIT_LE = 0xe, JIT_G = 0xf
+};
+
+enum JitOperandKind {JIT_IMM, JIT_MEM, JIT_REG};
+
+// Where a value is: an immediate number, a memory slot (a variable or a temporary), or a register
+struct JitOperand {
+    JitOperandKind kind;
+    int value;
+};
+
+struct JitContext {
+    RunState *state;
+    RunError error;
+};
+
+int JitRead(JitContext *ctx, int id) {
+    RunState *ps = ctx->state;
+    fprintf(ps->out, "Enter %s: ", ps->names->Name(id));
+    fflush(ps->out);
+    return ps->ReadInt();
+}
+
+void JitWriteVar(JitContext *ctx, int id, int value) {
+    fprintf(ctx->state->out, "%s: %d\n", ctx->state->names->Name(id), value);
+}
+
+void JitWrite(JitContext *ctx, int value) {
+    fprintf(ctx->state->out, "%d\n", value);
+}
+
+enum JitErrorKind {JIT_DIVISION_BY_ZERO, JIT_DIVISION_OVERFLOW};
+
+const char *const JitErrorStr[] = {"division by zero", "division overflow"};
+
+void JitError(JitContext *ctx, int line_num, int error) {
+    ctx->error.line_num = line_num;
+    ctx->error.message = JitErrorStr[error];
+}
+
+// The functions that the code calls, with ctx in rdi unless noted
+enum JitHelper {
+    JIT_READ, // esi = id, returns the number read
+    JIT_WRITE_VAR, // esi = id, edx = value
+    JIT_WRITE, // esi = value
+    JIT_POW, // edi = base, esi = exponent, returns IntPow()
+    JIT_ERROR, // esi = line number, edx = JitErrorKind
+    NUM_JIT_HELPERS
+};
+
+const unsigned long long jit_helper_address[NUM_JIT_HELPERS] = {
+        (unsigned long long) &JitRead, (unsigned long long) &JitWriteVar, (unsigned long long) &JitWrite,
+        (unsigned long long) &IntPow, (unsigned long long) &JitError
+};
+
+// A jump to the code that reports a division error
+struct JitErrorStub {
+    int patch; // the jump's rel32
+    int line_num;
+    JitErrorKind error;
+};
+
+struct JitCode {
+    vector<unsigned char> code;
+    int num_vars;
+    int num_temps; // memory slots after the variables for the values deeper than JIT_NUM_REGS
+    vector<JitErrorStub> stubs;
+    int helpers[NUM_JIT_HELPERS]; // the positions of the helpers in code, or -1 to call the Jit* functions
+
+    vector<pair<TreeNode *, int> > expr_stack; // see EmitJitExpr()
+    vector<JitOperand> values;
+
+    explicit JitCode(int _num_vars) {
+        num_vars = _num_vars;
+        num_temps = 0;
+        int i;
+        for (i = 0; i < NUM_JIT_HELPERS; i++) helpers[i] = -1;
+    }
+
+    void Byte(int b) {
+        code.push_back(b);
+    }
+
+    void Int32(int v) {
+        unsigned u = v;
+        int i;
+        for (i = 0; i < 4; i++) Byte(u >> 8 * i & 0xff);
+    }
+
+    void Int64(unsigned long long v) {
+        int i;
+        for (i = 0; i < 8; i++) Byte(v >> 8 * i & 0xff);
+    }
+
+    // An instruction with a ModRM byte: opcode (one byte, or two as 0x0fxx), reg field (a register or an opcode
+    // extension) and r/m operand, a register or a memory slot. w makes it 64-bit.
+    void Inst(int opcode, int reg, JitOperand rm, bool w = false) {
+        if (rm.kind == JIT_MEM) InstMem(opcode, reg, RBX, rm.value * 4, w);
+        else {
+            Rex(w, reg, rm.value);
+            Opcode(opcode);
+            Byte(0xc0 | (reg & 7) << 3 | (rm.value & 7));
+        }
+    }
+
+    // The same with the memory operand [base + disp]
+    void InstMem(int opcode, int reg, int base, int disp, bool w = false) {
+        Rex(w, reg, base);
+        Opcode(opcode);
+        Byte(0x80 | (reg & 7) << 3 | (base & 7)); // disp32
+        if ((base & 7) == RSP) Byte(0x24); // the SIB byte of a base without index
+        Int32(disp);
+    }
+
+    void Rex(bool w, int reg, int rm) {
+        int rex = 0x40 | w << 3 | (reg >> 3) << 2 | rm >> 3;
+        if (rex != 0x40) Byte(rex);
+    }
+
+    void Opcode(int opcode) {
+        if (opcode > 0xff) Byte(opcode >> 8);
+        Byte(opcode & 0xff);
+    }
+
+    void Push(int r) {
+        if (r >= R8) Byte(0x41);
+        Byte(0x50 | (r & 7));
+    }
+
+    void Pop(int r) {
+        if (r >= R8) Byte(0x41);
+        Byte(0x58 | (r & 7));
+    }
+
+    // Calls the function at an absolute address through rax
+    void Call(unsigned long long address) {
+        Byte(0x48);
+        Byte(0xb8); // mov rax, imm64
+        Int64(address);
+        Byte(0xff);
+        Byte(0xd0); // call rax
+    }
+
+    // Calls the code at a position
+    void CallTo(int target) {
+        Byte(0xe8);
+        Int32(0);
+        PatchTo(code.size() - 4, target);
+    }
+
+    void CallHelper(JitHelper helper) {
+        if (helpers[helper] >= 0) CallTo(helpers[helper]);
+        else Call(jit_helper_address[helper]);
+    }
+
+    // add rsp, bytes (a multiple of 8 that fits in a byte)
+    void AddStack(int bytes) {
+        JitOperand rsp = {JIT_REG, RSP};
+        Inst(0x83, 0, rsp, true);
+        Byte(bytes);
+    }
+
+    // add operand, k
+    void Add(JitOperand a, int k, bool w = false) {
+        Inst(0x81, 0, a, w);
+        Int32(k);
+    }
+
+    void Syscall() {
+        Byte(0x0f);
+        Byte(0x05);
+    }
+
+    void Ret() {
+        Byte(0xc3);
+    }
+
+    // Returns the position of the rel32 to patch. A target < 0 is patched later.
+    int Jump(int target) {
+        Byte(0xe9);
+        Int32(0);
+        int patch = code.size() - 4;
+        if (target >= 0) PatchTo(patch, target);
+        return patch;
+    }
+
+    int JumpIf(JitCond cond, int target) {
+        Byte(0x0f);
+        Byte(0x80 | cond);
+        Int32(0);
+        int patch = code.size() - 4;
+        if (target >= 0) PatchTo(patch, target);
+        return patch;
+    }
+
+    void PatchTo(int patch, int target) {
+        int rel = target - (patch + 4);
+        memcpy(&code[patch], &rel, 4);
+    }
+
+    // Makes a forward jump land at the next instruction
+    void Patch(int patch) {
+        if (patch >= 0) PatchTo(patch, code.size());
+    }
+
+    // mov r32, operand
+    void Load(int r, JitOperand a) {
+        if (a.kind == JIT_IMM) {
+            if (r >= R8) Byte(0x41);
+            Byte(0xb8 | (r & 7));
+            Int32(a.value);
+        } else if (a.kind == JIT_MEM || a.value != r) Inst(0x8b, r, a);
+    }
+
+    // cmp a, b, where a is not an immediate
+    void Compare(JitOperand a, JitOperand b) {
+        if (b.kind == JIT_IMM) {
+            Inst(0x81, 7, a);
+            Int32(b.value);
+        } else if (a.kind == JIT_REG) Inst(0x3b, a.value, b);
+        else if (b.kind == JIT_REG) Inst(0x39, b.value, a);
+        else {
+            Load(RAX, a);
+            Inst(0x3b, RAX, b);
+        }
+    }
+
+    // rdi = ctx, the first argument of the helpers
+    void LoadContext() {
+        JitOperand rdi = {JIT_REG, RDI};
+        Inst(0x89, R12, rdi, true);
+    }
+};
+
+JitOperand JitRegister(int r) {
+    JitOperand operand = {JIT_REG, r};
+    return operand;
+}
+
+JitOperand JitImmediate(int k) {
+    JitOperand operand = {JIT_IMM, k};
+    return operand;
+}
+
+// eax = a / b, with the checks of Divide() unless b is a number that can not fail
+void EmitJitDivide(JitCode *pj, TreeNode *node, JitOperand a, JitOperand b) {
+    bool safe = b.kind == JIT_IMM && b.value != 0 && b.value != -1;
+    if (b.kind == JIT_IMM) {
+        pj->Load(R11, b);
+        b = JitRegister(R11);
+    }
+    pj->Load(RAX, a);
+
+    if (!safe) {
+        JitErrorStub stub = {0, node->line_num, JIT_DIVISION_BY_ZERO};
+        pj->Compare(b, JitImmediate(0));
+        stub.patch = pj->JumpIf(JIT_E, -1);
+        pj->stubs.push_back(stub);
+
+        pj->Compare(b, JitImmediate(-1));
+        int skip = pj->JumpIf(JIT_NE, -1);
+        pj->Compare(JitRegister(RAX), JitImmediate(INT_MIN));
+        stub.error = JIT_DIVISION_OVERFLOW;
+        stub.patch = pj->JumpIf(JIT_E, -1);
+        pj->stubs.push_back(stub);
+        pj->Patch(skip);
+    }
+
+    pj->Byte(0x99); // cdq
+    pj->Inst(0xf7, 7, b); // idiv
+}
+
+// eax = IntPow(a, b), saving the registers of the values below depth i
+void EmitJitPower(JitCode *pj, JitOperand a, JitOperand b, int i) {
+    int live = min(i, JIT_NUM_REGS), j;
+    for (j = 0; j < live; j++) pj->Push(jit_regs[j]);
+    if (live % 2) pj->AddStack(-8); // the stack stays 16-byte aligned for the call
+
+    // a or b may be in rdi or rsi
+    pj->Load(R11, b);
+    pj->Load(RDI, a);
+    pj->Load(RSI, JitRegister(R11));
+    pj->CallHelper(JIT_POW);
+
+    if (live % 2) pj->AddStack(8);
+    for (j = live - 1; j >= 0; j--) pj->Pop(jit_regs[j]);
+}
+
+// eax = MagicDivide(a, magic), a multiply-high in place of idiv
+void EmitJitMagicDivide(JitCode *pj, JitOperand a, DivisionMagic magic) {
+    JitOperand rax = JitRegister(RAX), r11 = JitRegister(R11);
+    pj->Inst(0x63, R11, a, true); // movsxd r11, a
+    pj->Inst(0x69, RAX, r11, true); // imul rax, r11, multiplier
+    pj->Int32(magic.multiplier);
+    pj->Inst(0xc1, 7, rax, true); // sar rax, 32 (+ shift)
+    if (magic.multiplier >= 0) pj->Byte(32 + magic.shift);
+    else {
+        pj->Byte(32);
+        pj->Inst(0x03, RAX, r11); // add eax, r11d
+        if (magic.shift) {
+            pj->Inst(0xc1, 7, rax); // sar eax, shift
+            pj->Byte(magic.shift);
+        }
+    }
+    pj->Inst(0xc1, 5, r11); // shr r11d, 31: one more when a is negative
+    pj->Byte(31);
+    pj->Inst(0x03, RAX, r11);
+}
+
+// Emits node's operation of a and b, the values at depth i and i + 1, or folds it into a number. Returns the
+// place of the result, the value at depth i.
+JitOperand EmitJitOper(JitCode *pj, TreeNode *node, JitOperand a, JitOperand b, int i) {
+    TokenType oper = node->oper;
+    if (a.kind == JIT_IMM && b.kind == JIT_IMM &&
+        !(oper == DIVIDE && (b.value == 0 || (b.value == -1 && a.value == INT_MIN)))) {
+        JitOperand result = {JIT_IMM, Operate(node, a.value, b.value)};
+        return result;
+    }
+
+    // the number on the right of + * and =
+    if (a.kind == JIT_IMM && (oper == PLUS || oper == TIMES || oper == EQUAL)) swap(a, b);
+
+    int w = i < JIT_NUM_REGS ? jit_regs[i] : RAX;
+    switch (oper) {
+        case PLUS:
+        case MINUS:
+            pj->Load(w, a);
+            if (b.kind == JIT_IMM) {
+                pj->Inst(0x81, oper == PLUS ? 0 : 5, JitRegister(w));
+                pj->Int32(b.value);
+            } else pj->Inst(oper == PLUS ? 0x03 : 0x2b, w, b);
+            break;
+        case TIMES:
+            if (b.kind == JIT_IMM) {
+                pj->Inst(0x69, w, a); // imul w, a, imm32
+                pj->Int32(b.value);
+            } else {
+                pj->Load(w, a);
+                pj->Inst(0x0faf, w, b);
+            }
+            break;
+        case DIVIDE:
+            EmitJitDivide(pj, node, a, b);
+            pj->Load(w, JitRegister(RAX));
+            break;
+        case POWER:
+            EmitJitPower(pj, a, b, i);
+            pj->Load(w, JitRegister(RAX));
+            break;
+        case SHIFT_LEFT:
+            pj->Load(w, a);
+            pj->Inst(0xc1, 4, JitRegister(w)); // shl w, k
+            pj->Byte(b.value);
+            break;
+        case SHIFT_DIVIDE:
+            // w = (a + (a < 0 ? 2^k - 1 : 0)) >> k
+            pj->Load(w, a);
+            pj->Load(R11, JitRegister(w));
+            pj->Inst(0xc1, 7, JitRegister(R11)); // sar r11d, 31
+            pj->Byte(31);
+            pj->Inst(0xc1, 5, JitRegister(R11)); // shr r11d, 32 - k
+            pj->Byte(32 - b.value);
+            pj->Inst(0x03, w, JitRegister(R11));
+            pj->Inst(0xc1, 7, JitRegister(w)); // sar w, k
+            pj->Byte(b.value);
+            break;
+        case MAGIC_DIVIDE:
+            EmitJitMagicDivide(pj, a, MakeDivisionMagic(b.value));
+            pj->Load(w, JitRegister(RAX));
+            break;
+        case CONST_POWER: {
+            // squaring for each bit of k below the top one, unrolled, and a multiply by a where the bit is set
+            pj->Load(R11, a);
+            pj->Load(w, b.value ? JitRegister(R11) : JitImmediate(1));
+            int bit = 30;
+            while (bit > 0 && !(b.value >> bit & 1)) bit--;
+            for (bit--; bit >= 0; bit--) {
+                pj->Inst(0x0faf, w, JitRegister(w));
+                if (b.value >> bit & 1) pj->Inst(0x0faf, w, JitRegister(R11));
+            }
+            break;
+        }
+        default:
+            pj->Load(w, a);
+            pj->Compare(JitRegister(w), b);
+            pj->Inst(0x0f90 | (oper == LESS_THAN ? JIT_L : JIT_E), 0, JitRegister(RAX)); // setcc al
+            pj->Inst(0x0fb6, w, JitRegister(RAX)); // movzx w, al
+            break;
+    }
+
+    JitOperand result = {JIT_REG, w};
+    if (i >= JIT_NUM_REGS) {
+        result.kind = JIT_MEM;
+        result.value = pj->num_vars + i;
+        if (i + 1 > pj->num_temps) pj->num_temps = i + 1;
+        pj->Inst(0x89, RAX, result);
+    }
+    return result;
+}
+
+// Emits the code of an expression whose values start at depth base, in the postorder of Evaluate(), and returns
+// where its value is.
+JitOperand EmitJitExpr(JitCode *pj, TreeNode *expr, int base) {
+    vector<pair<TreeNode *, int> > &stack = pj->expr_stack;
+    vector<JitOperand> &values = pj->values;
+    stack.clear();
+    values.clear();
+    stack.push_back(make_pair(expr, 0));
+
+    while (!stack.empty()) {
+        TreeNode *node = stack.back().first;
+        int i = stack.back().second;
+
+        if (node->node_kind == OPER_NODE && i < 2) {
+            stack.back().second++;
+            stack.push_back(make_pair(node->child[i], 0));
+            continue;
+        }
+        stack.pop_back();
+
+        JitOperand value = {JIT_IMM, 0};
+        if (node->node_kind == NUM_NODE) value.value = node->num;
+        else if (node->node_kind == ID_NODE) {
+            value.kind = JIT_MEM;
+            value.value = node->var->memloc;
+        } else {
+            JitOperand b = values.back();
+            values.pop_back();
+            JitOperand a = values.back();
+            values.pop_back();
+            value = EmitJitOper(pj, node, a, b, base + values.size());
+        }
+        values.push_back(value);
+    }
+    return values.back();
+}
+
+// Emits a jump to target (< 0 to patch later) when the condition is false. Returns the rel32 to patch, or -1 when
+// the condition is always true and nothing was emitted.
+int EmitJitJumpIfFalse(JitCode *pj, TreeNode *cond, int target) {
+    if (cond->node_kind != OPER_NODE || (cond->oper != LESS_THAN && cond->oper != EQUAL)) {
+        JitOperand value = EmitJitExpr(pj, cond, 0);
+        if (value.kind == JIT_IMM) return value.value ? -1 : pj->Jump(target);
+        pj->Compare(value, JitImmediate(0));
+        return pj->JumpIf(JIT_E, target);
+    }
+
+    JitOperand a = EmitJitExpr(pj, cond->child[0], 0);
+    JitOperand b = EmitJitExpr(pj, cond->child[1], 1);
+    bool less = cond->oper == LESS_THAN;
+    if (a.kind == JIT_IMM && b.kind == JIT_IMM) {
+        bool value = less ? a.value < b.value : a.value == b.value;
+        return value ? -1 : pj->Jump(target);
+    }
+
+    // jump if not (a < b), not (k < b) with the number moved to the right, or a != b
+    JitCond jump = less ? JIT_GE : JIT_NE;
+    if (a.kind == JIT_IMM) {
+        swap(a, b);
+        if (less) jump = JIT_LE;
+    }
+    pj->Compare(a, b);
+    return pj->JumpIf(jump, target);
+}
+
+// Compiles the statements from root on, with the frames of CompileProgram(), into a whole function
+void CompileJit(JitCode *pj, TreeNode *root) {
+    // push rbp; mov rbp, rsp; push rbx; push r12 (the stack is 16-byte aligned after them)
+    pj->Push(RBP);
+    pj->Inst(0x89, RSP, JitRegister(RBP), true);
+    pj->Push(RBX);
+    pj->Push(R12);
+    pj->Inst(0x89, RDI, JitRegister(RBX), true);
+    pj->Inst(0x89, RSI, JitRegister(R12), true);
+
+    struct CodeFrame {
+        TreeNode *node;
+        int state;
+        int label;
+    };
+    vector<CodeFrame> stack;
+    CodeFrame frame = {root, 0, 0};
+    stack.push_back(frame);
+
+    while (!stack.empty()) {
+        CodeFrame *pf = &stack.back();
+        TreeNode *node = pf->node;
+        if (!node) {
+            stack.pop_back();
+            continue;
+        }
+
+        CodeFrame next = {node->sibling, 0, 0};
+        switch (node->node_kind) {
+            case IF_NODE:
+                if (pf->state == 0) {
+                    pf->label = EmitJitJumpIfFalse(pj, node->child[0], -1);
+                    pf->state = 1;
+                    frame.node = node->child[1];
+                    stack.push_back(frame);
+                } else if (pf->state == 1 && node->child[2]) {
+                    int jump = pj->Jump(-1);
+                    pj->Patch(pf->label);
+                    pf->label = jump;
+                    pf->state = 2;
+                    frame.node = node->child[2];
+                    stack.push_back(frame);
+                } else {
+                    pj->Patch(pf->label);
+                    *pf = next;
+                }
+                break;
+            case REPEAT_NODE:
+                if (pf->state == 0) {
+                    pf->label = pj->code.size();
+                    pf->state = 1;
+                    frame.node = node->child[0];
+                    stack.push_back(frame);
+                } else {
+                    EmitJitJumpIfFalse(pj, node->child[1], pf->label);
+                    *pf = next;
+                }
+                break;
+            case ASSIGN_NODE: {
+                JitOperand value = EmitJitExpr(pj, node->child[0], 0);
+                JitOperand var = {JIT_MEM, node->var->memloc};
+                if (value.kind == JIT_IMM) {
+                    pj->Inst(0xc7, 0, var);
+                    pj->Int32(value.value);
+                } else if (value.kind == JIT_MEM) {
+                    pj->Load(RAX, value);
+                    pj->Inst(0x89, RAX, var);
+                } else pj->Inst(0x89, value.value, var);
+                *pf = next;
+                break;
+            }
+            case READ_NODE: {
+                JitOperand var = {JIT_MEM, node->var->memloc};
+                pj->LoadContext();
+                pj->Load(RSI, JitImmediate(node->id));
+                pj->CallHelper(JIT_READ);
+                pj->Inst(0x89, RAX, var);
+                *pf = next;
+                break;
+            }
+            case WRITE_NODE: {
+                TreeNode *expr = node->child[0];
+                JitOperand value = EmitJitExpr(pj, expr, 0);
+                if (expr->node_kind == ID_NODE) {
+                    pj->Load(RDX, value);
+                    pj->Load(RSI, JitImmediate(expr->id));
+                    pj->LoadContext();
+                    pj->CallHelper(JIT_WRITE_VAR);
+                } else {
+                    pj->Load(RSI, value);
+                    pj->LoadContext();
+                    pj->CallHelper(JIT_WRITE);
+                }
+                *pf = next;
+                break;
+            }
+            default:
+                *pf = next;
+                break;
+        }
+    }
+
+    // xor eax, eax, and the epilogue that the error stubs also jump to
+    pj->Byte(0x31);
+    pj->Byte(0xc0);
+    int exit = pj->code.size();
+    pj->Pop(R12);
+    pj->Pop(RBX);
+    pj->Pop(RBP);
+    pj->Ret();
+
+    size_t i;
+    for (i = 0; i < pj->stubs.size(); i++) {
+        pj->Patch(pj->stubs[i].patch);
+        pj->LoadContext();
+        pj->Load(RSI, JitImmediate(pj->stubs[i].line_num));
+        pj->Load(RDX, JitImmediate(pj->stubs[i].error));
+        pj->CallHelper(JIT_ERROR);
+        pj->Load(RAX, JitImmediate(1));
+        pj->Jump(exit);
+    }
+}
+
+#ifdef TINY_HAVE_JIT
+
+// Copies the code to executable memory and runs it in the memory of ps
+void RunJit(RunState *ps, const JitCode *pj) {
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t size = (pj->code.size() + page - 1) / page * page;
+    void *p = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    RunError error = {0, "can not map memory for the JIT code"};
+    if (p == MAP_FAILED) throw error;
+    memcpy(p, &pj->code[0], pj->code.size());
+    if (mprotect(p, size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(p, size);
+        error.message = "can not make the JIT code executable";
+        throw error;
+    }
+
+    ps->memory.resize(pj->num_vars + pj->num_temps);
+    JitContext ctx = {ps, {0, 0}};
+    int (*function)(int *, JitContext *) = (int (*)(int *, JitContext *)) p;
+    int failed = function(ps->memory.data(), &ctx);
+    munmap(p, size);
+    if (failed) throw ctx.error;
+}
+
+#endif // TINY_HAVE_JIT
+
+////////////////////////////////////////////////////////////////////////////////////
+// ELF /////////////////////////////////////////////////////////////////////////////
+
+// A static x86-64 Linux executable written without a toolchain or libc: the code of the JIT section, whose
+// helpers are a small runtime in the same code that reads and writes through system calls. The file is the ELF
+// header, the program headers and the text segment (read only data, the runtime, the program function and the
+// entry point). The data segment, at a fixed address, is zeroed memory: the runtime's state, then the variables.
+
+#define ELF_TEXT_ADDRESS 0x400000
+#define ELF_NUM_SEGMENTS 3 // text, data, and the one that keeps the stack not executable
+#define ELF_HEADERS_SIZE (64 + ELF_NUM_SEGMENTS * 56)
+#define ELF_DATA_ADDRESS 0x40000000 // the text must end before it
+#define ELF_BUFFER_SIZE 4096
+
+// The runtime's state at the start of the data segment, r12 points to it
+enum ElfState {
+    ELF_OUT_LEN = 0, ELF_IN_POS = 4, ELF_IN_LEN = 8, ELF_INPUT_FAILED = 12, ELF_OUT_FD = 16, ELF_OUT_BUF = 32,
+    ELF_IN_BUF = ELF_OUT_BUF + ELF_BUFFER_SIZE, ELF_STATE_SIZE = ELF_IN_BUF + ELF_BUFFER_SIZE
+};
+
+// The address of a position in the code, which follows the headers in the text segment
+int ElfAddress(int pos) {
+    return ELF_TEXT_ADDRESS + ELF_HEADERS_SIZE + pos;
+}
+
+struct ElfString {
+    int address;
+    int len;
+};
+
+// The positions of the runtime's functions, and its strings
+struct ElfRuntime {
+    int flush; // writes the output buffer to out_fd
+    int put; // rsi = bytes, edx = count: adds them to the output buffer
+    int put_int; // esi = value
+    int put_name; // esi = id
+    int get_char; // returns the next input byte in eax, or -1 at the end
+    int read_int; // returns the next number like RunState::ReadInt()
+    int exit; // edi = exit code
+    ElfString enter, colon, newline, error_at, errors[2];
+    int names; // the address of the address and length of the name of each id
+};
+
+ElfString ElfData(JitCode *pj, const char *s, int len) {
+    ElfString str = {ElfAddress(pj->code.size()), len};
+    pj->code.insert(pj->code.end(), s, s + len);
+    return str;
+}
+
+void ElfPut(JitCode *pj, const ElfRuntime *rt, ElfString str) {
+    pj->Load(RSI, JitImmediate(str.address));
+    pj->Load(RDX, JitImmediate(str.len));
+    pj->CallTo(rt->put);
+}
+
+// Emits the read only data and the runtime: its functions and the helpers of the JIT section. They use r12 as the
+// state, and the caller saved registers.
+void EmitElfRuntime(JitCode *pj, const Interner *names, ElfRuntime *rt) {
+    rt->enter = ElfData(pj, "Enter ", 6);
+    rt->colon = ElfData(pj, ": ", 2);
+    rt->newline = ElfData(pj, "\n", 1);
+    rt->error_at = ElfData(pj, "Error at line ", 14);
+    int i;
+    for (i = 0; i < 2; i++) rt->errors[i] = ElfData(pj, JitErrorStr[i], strlen(JitErrorStr[i]));
+
+    vector<ElfString> name_strs;
+    for (i = 0; i < names->NumIds(); i++) name_strs.push_back(ElfData(pj, names->Name(i), names->NameLen(i)));
+    while (pj->code.size() % 4) pj->Byte(0);
+    rt->names = ElfAddress(pj->code.size());
+    for (i = 0; i < names->NumIds(); i++) {
+        pj->Int32(name_strs[i].address);
+        pj->Int32(name_strs[i].len);
+    }
+
+    const JitOperand rax = JitRegister(RAX), rcx = JitRegister(RCX), rdx = JitRegister(RDX),
+            rsi = JitRegister(RSI), r8 = JitRegister(R8), r9 = JitRegister(R9), r10 = JitRegister(R10);
+    int loop, done, skip, other;
+
+    rt->flush = pj->code.size();
+    pj->InstMem(0x8b, RDX, R12, ELF_OUT_LEN); // mov edx, [r12 + out_len]
+    pj->InstMem(0x8d, RSI, R12, ELF_OUT_BUF, true); // lea rsi, [r12 + out_buf]
+    loop = pj->code.size();
+    pj->Inst(0x85, RDX, rdx); // test edx, edx
+    done = pj->JumpIf(JIT_E, -1);
+    pj->Load(RAX, JitImmediate(1)); // write
+    pj->InstMem(0x8b, RDI, R12, ELF_OUT_FD); // mov edi, [r12 + out_fd]
+    pj->Syscall();
+    pj->Inst(0x85, RAX, rax, true); // test rax, rax
+    skip = pj->JumpIf(JIT_LE, -1); // the output is lost when it can not be written
+    pj->Inst(0x01, RAX, rsi, true); // add rsi, rax
+    pj->Inst(0x29, RAX, rdx); // sub edx, eax
+    pj->Jump(loop);
+    pj->Patch(done);
+    pj->Patch(skip);
+    pj->InstMem(0xc7, 0, R12, ELF_OUT_LEN); // mov dword [r12 + out_len], 0
+    pj->Int32(0);
+    pj->Ret();
+
+    rt->put = pj->code.size();
+    loop = pj->code.size();
+    pj->Inst(0x85, RDX, rdx); // test edx, edx
+    done = pj->JumpIf(JIT_E, -1);
+    pj->InstMem(0x8b, RCX, R12, ELF_OUT_LEN); // mov ecx, [r12 + out_len]
+    pj->Compare(rcx, JitImmediate(ELF_BUFFER_SIZE));
+    skip = pj->JumpIf(JIT_NE, -1);
+    pj->Push(RSI);
+    pj->Push(RDX);
+    pj->CallTo(rt->flush);
+    pj->Pop(RDX);
+    pj->Pop(RSI);
+    pj->Inst(0x31, RCX, rcx); // xor ecx, ecx
+    pj->Patch(skip);
+    pj->InstMem(0x0fb6, RAX, RSI, 0); // movzx eax, byte [rsi]
+    pj->InstMem(0x8d, R8, R12, ELF_OUT_BUF, true); // lea r8, [r12 + out_buf]
+    pj->Inst(0x01, RCX, r8, true); // add r8, rcx
+    pj->InstMem(0x88, RAX, R8, 0); // mov [r8], al
+    pj->Add(rcx, 1);
+    pj->InstMem(0x89, RCX, R12, ELF_OUT_LEN); // mov [r12 + out_len], ecx
+    pj->Add(rsi, 1, true);
+    pj->Add(rdx, -1);
+    pj->Jump(loop);
+    pj->Patch(done);
+    pj->Ret();
+
+    // the digits are written backwards into 16 bytes of stack
+    rt->put_int = pj->code.size();
+    pj->AddStack(-16);
+    pj->Load(RAX, rsi);
+    pj->Load(R9, rsi); // the sign
+    pj->InstMem(0x8d, R8, RSP, 16, true); // lea r8, [rsp + 16]
+    pj->Inst(0x85, RAX, rax); // test eax, eax
+    skip = pj->JumpIf(JIT_NS, -1);
+    pj->Inst(0xf7, 3, rax); // neg eax, the smallest int stays 2^31 unsigned
+    pj->Patch(skip);
+    pj->Load(RCX, JitImmediate(10));
+    loop = pj->code.size();
+    pj->Inst(0x31, RDX, rdx); // xor edx, edx
+    pj->Inst(0xf7, 6, rcx); // div ecx
+    pj->Add(rdx, '0');
+    pj->Add(r8, -1, true);
+    pj->InstMem(0x88, RDX, R8, 0); // mov [r8], dl
+    pj->Inst(0x85, RAX, rax); // test eax, eax
+    pj->JumpIf(JIT_NE, loop);
+    pj->Inst(0x85, R9, r9); // test r9d, r9d
+    skip = pj->JumpIf(JIT_NS, -1);
+    pj->Add(r8, -1, true);
+    pj->InstMem(0xc6, 0, R8, 0); // mov byte [r8], '-'
+    pj->Byte('-');
+    pj->Patch(skip);
+    pj->Inst(0x89, R8, rsi, true); // mov rsi, r8
+    pj->InstMem(0x8d, RDX, RSP, 16, true); // lea rdx, [rsp + 16]
+    pj->Inst(0x29, R8, rdx, true); // sub rdx, r8
+    pj->CallTo(rt->put);
+    pj->AddStack(16);
+    pj->Ret();
+
+    rt->put_name = pj->code.size();
+    pj->Inst(0x69, RAX, rsi); // imul eax, esi, 8
+    pj->Int32(8);
+    pj->Load(R8, JitImmediate(rt->names));
+    pj->Inst(0x01, RAX, r8, true); // add r8, rax
+    pj->InstMem(0x8b, RSI, R8, 0); // mov esi, [r8]
+    pj->InstMem(0x8b, RDX, R8, 4); // mov edx, [r8 + 4]
+    pj->Jump(rt->put);
+
+    rt->get_char = pj->code.size();
+    pj->InstMem(0x8b, RCX, R12, ELF_IN_POS); // mov ecx, [r12 + in_pos]
+    pj->InstMem(0x3b, RCX, R12, ELF_IN_LEN); // cmp ecx, [r12 + in_len]
+    skip = pj->JumpIf(JIT_L, -1);
+    pj->Inst(0x31, RAX, rax); // read
+    pj->Inst(0x31, RDI, JitRegister(RDI)); // stdin
+    pj->InstMem(0x8d, RSI, R12, ELF_IN_BUF, true); // lea rsi, [r12 + in_buf]
+    pj->Load(RDX, JitImmediate(ELF_BUFFER_SIZE));
+    pj->Syscall();
+    pj->Inst(0x85, RAX, rax, true); // test rax, rax
+    done = pj->JumpIf(JIT_G, -1);
+    pj->InstMem(0xc7, 0, R12, ELF_IN_LEN); // mov dword [r12 + in_len], 0
+    pj->Int32(0);
+    pj->InstMem(0xc7, 0, R12, ELF_IN_POS); // mov dword [r12 + in_pos], 0
+    pj->Int32(0);
+    pj->Load(RAX, JitImmediate(-1));
+    pj->Ret();
+    pj->Patch(done);
+    pj->InstMem(0x89, RAX, R12, ELF_IN_LEN); // mov [r12 + in_len], eax
+    pj->Inst(0x31, RCX, rcx); // xor ecx, ecx
+    pj->Patch(skip);
+    pj->InstMem(0x8d, R8, R12, ELF_IN_BUF, true); // lea r8, [r12 + in_buf]
+    pj->Inst(0x01, RCX, r8, true); // add r8, rcx
+    pj->InstMem(0x0fb6, RAX, R8, 0); // movzx eax, byte [r8]
+    pj->Add(rcx, 1);
+    pj->InstMem(0x89, RCX, R12, ELF_IN_POS); // mov [r12 + in_pos], ecx
+    pj->Ret();
+
+    // r9d is the sign and r10 the number, get_char does not use them
+    rt->read_int = pj->code.size();
+    pj->InstMem(0x81, 7, R12, ELF_INPUT_FAILED); // cmp dword [r12 + input_failed], 0
+    pj->Int32(0);
+    skip = pj->JumpIf(JIT_E, -1);
+    pj->Inst(0x31, RAX, rax); // xor eax, eax
+    pj->Ret();
+    pj->Patch(skip);
+    loop = pj->code.size();
+    pj->CallTo(rt->get_char);
+    pj->Compare(rax, JitImmediate(' '));
+    pj->JumpIf(JIT_E, loop);
+    pj->Load(RCX, rax);
+    pj->Add(rcx, -'\t');
+    pj->Compare(rcx, JitImmediate('\r' - '\t'));
+    pj->JumpIf(JIT_BE, loop);
+    pj->Inst(0x31, R9, r9); // xor r9d, r9d
+    pj->Compare(rax, JitImmediate('-'));
+    other = pj->JumpIf(JIT_NE, -1);
+    pj->Load(R9, JitImmediate(1));
+    pj->CallTo(rt->get_char);
+    done = pj->Jump(-1);
+    pj->Patch(other);
+    pj->Compare(rax, JitImmediate('+'));
+    skip = pj->JumpIf(JIT_NE, -1);
+    pj->CallTo(rt->get_char);
+    pj->Patch(skip);
+    pj->Patch(done);
+
+    // no number: give the byte back, fail and return 0
+    pj->Load(RCX, rax);
+    pj->Add(rcx, -'0');
+    pj->Compare(rcx, JitImmediate(9));
+    done = pj->JumpIf(JIT_BE, -1);
+    pj->Compare(rax, JitImmediate(-1));
+    skip = pj->JumpIf(JIT_E, -1);
+    pj->InstMem(0x81, 5, R12, ELF_IN_POS); // sub dword [r12 + in_pos], 1
+    pj->Int32(1);
+    pj->Patch(skip);
+    pj->InstMem(0xc7, 0, R12, ELF_INPUT_FAILED); // mov dword [r12 + input_failed], 1
+    pj->Int32(1);
+    pj->Inst(0x31, RAX, rax); // xor eax, eax
+    pj->Ret();
+    pj->Patch(done);
+
+    pj->Inst(0x31, R10, r10); // xor r10d, r10d
+    loop = pj->code.size();
+    pj->Inst(0x81, 7, r10, true); // cmp r10, INT_MAX
+    pj->Int32(INT_MAX);
+    skip = pj->JumpIf(JIT_G, -1);
+    pj->Inst(0x69, R10, r10, true); // imul r10, r10, 10
+    pj->Int32(10);
+    pj->Inst(0x01, RCX, r10, true); // add r10, rcx
+    pj->Patch(skip);
+    pj->CallTo(rt->get_char);
+    pj->Load(RCX, rax);
+    pj->Add(rcx, -'0');
+    pj->Compare(rcx, JitImmediate(9));
+    pj->JumpIf(JIT_BE, loop);
+    pj->Compare(rax, JitImmediate(-1));
+    skip = pj->JumpIf(JIT_E, -1);
+    pj->InstMem(0x81, 5, R12, ELF_IN_POS); // sub dword [r12 + in_pos], 1
+    pj->Int32(1);
+    pj->Patch(skip);
+    pj->Inst(0x85, R9, r9); // test r9d, r9d
+    skip = pj->JumpIf(JIT_E, -1);
+    pj->Inst(0xf7, 3, r10, true); // neg r10
+    pj->Patch(skip);
+
+    // out of range: fail and return the nearest int
+    pj->Inst(0x81, 7, r10, true); // cmp r10, INT_MAX
+    pj->Int32(INT_MAX);
+    other = pj->JumpIf(JIT_G, -1);
+    pj->Inst(0x81, 7, r10, true); // cmp r10, INT_MIN
+    pj->Int32(INT_MIN);
+    skip = pj->JumpIf(JIT_L, -1);
+    pj->Load(RAX, r10);
+    pj->Ret();
+    pj->Patch(other);
+    pj->Load(RAX, JitImmediate(INT_MAX));
+    done = pj->Jump(-1);
+    pj->Patch(skip);
+    pj->Load(RAX, JitImmediate(INT_MIN));
+    pj->Patch(done);
+    pj->InstMem(0xc7, 0, R12, ELF_INPUT_FAILED); // mov dword [r12 + input_failed], 1
+    pj->Int32(1);
+    pj->Ret();
+
+    rt->exit = pj->code.size();
+    pj->Push(RDI);
+    pj->CallTo(rt->flush);
+    pj->Pop(RDI);
+    pj->Load(RAX, JitImmediate(231)); // exit_group
+    pj->Syscall();
+
+    pj->helpers[JIT_READ] = pj->code.size();
+    pj->Push(RSI);
+    ElfPut(pj, rt, rt->enter);
+    pj->Pop(RSI);
+    pj->CallTo(rt->put_name);
+    ElfPut(pj, rt, rt->colon);
+    pj->CallTo(rt->flush);
+    pj->Jump(rt->read_int);
+
+    pj->helpers[JIT_WRITE_VAR] = pj->code.size();
+    pj->Push(RDX);
+    pj->CallTo(rt->put_name);
+    ElfPut(pj, rt, rt->colon);
+    pj->Pop(RSI);
+    pj->CallTo(rt->put_int);
+    ElfPut(pj, rt, rt->newline);
+    pj->Ret();
+
+    pj->helpers[JIT_WRITE] = pj->code.size();
+    pj->CallTo(rt->put_int);
+    ElfPut(pj, rt, rt->newline);
+    pj->Ret();
+
+    // IntPow(edi, esi), a negative exponent gives 1, -1 or 0
+    pj->helpers[JIT_POW] = pj->code.size();
+    const JitOperand rdi = JitRegister(RDI);
+    pj->Load(RAX, JitImmediate(1));
+    pj->Inst(0x85, RSI, rsi); // test esi, esi
+    skip = pj->JumpIf(JIT_NS, -1);
+    pj->Compare(rdi, JitImmediate(1));
+    done = pj->JumpIf(JIT_E, -1);
+    pj->Compare(rdi, JitImmediate(-1));
+    other = pj->JumpIf(JIT_NE, -1);
+    pj->Inst(0xf7, 0, rsi); // test esi, 1
+    pj->Int32(1);
+    int even = pj->JumpIf(JIT_E, -1);
+    pj->Load(RAX, JitImmediate(-1));
+    pj->Ret();
+    pj->Patch(other);
+    pj->Inst(0x31, RAX, rax); // xor eax, eax
+    pj->Patch(done);
+    pj->Patch(even);
+    pj->Ret();
+    pj->Patch(skip);
+    loop = pj->code.size();
+    pj->Inst(0x85, RSI, rsi); // test esi, esi
+    done = pj->JumpIf(JIT_E, -1);
+    pj->Inst(0xf7, 0, rsi); // test esi, 1
+    pj->Int32(1);
+    skip = pj->JumpIf(JIT_E, -1);
+    pj->Inst(0x0faf, RAX, rdi); // imul eax, edi
+    pj->Patch(skip);
+    pj->Inst(0x0faf, RDI, rdi); // imul edi, edi
+    pj->Inst(0xd1, 5, rsi); // shr esi, 1
+    pj->Jump(loop);
+    pj->Patch(done);
+    pj->Ret();
+
+    // the message goes to stderr after the output so far
+    pj->helpers[JIT_ERROR] = pj->code.size();
+    pj->Push(RDX);
+    pj->Push(RSI);
+    pj->CallTo(rt->flush);
+    pj->InstMem(0xc7, 0, R12, ELF_OUT_FD); // mov dword [r12 + out_fd], 2
+    pj->Int32(2);
+    ElfPut(pj, rt, rt->error_at);
+    pj->Pop(RSI);
+    pj->CallTo(rt->put_int);
+    ElfPut(pj, rt, rt->colon);
+    pj->Pop(RDX);
+    pj->Compare(rdx, JitImmediate(JIT_DIVISION_BY_ZERO));
+    other = pj->JumpIf(JIT_NE, -1);
+    ElfPut(pj, rt, rt->errors[JIT_DIVISION_BY_ZERO]);
+    done = pj->Jump(-1);
+    pj->Patch(other);
+    ElfPut(pj, rt, rt->errors[JIT_DIVISION_OVERFLOW]);
+    pj->Patch(done);
+    ElfPut(pj, rt, rt->newline);
+    pj->CallTo(rt->flush);
+    pj->InstMem(0xc7, 0, R12, ELF_OUT_FD); // mov dword [r12 + out_fd], 1
+    pj->Int32(1);
+    pj->Ret();
+}
+
+void ElfPut16(vector<unsigned char> *file, unsigned v) {
+    file->push_back(v & 0xff);
+    file->push_back(v >> 8 & 0xff);
+}
+
+void ElfPut32(vector<unsigned char> *file, unsigned v) {
+    ElfPut16(file, v & 0xffff);
+    ElfPut16(file, v >> 16);
+}
+
+void ElfPut64(vector<unsigned char> *file, unsigned long long v) {
+    ElfPut32(file, v & 0xffffffffu);
+    ElfPut32(file, v >> 32);
+}
+
+void ElfSegment(vector<unsigned char> *file, unsigned type, unsigned flags, unsigned long long address,
+                unsigned long long file_size, unsigned long long mem_size) {
+    ElfPut32(file, type);
+    ElfPut32(file, flags);
+    ElfPut64(file, 0); // offset: the text segment starts the file, the others have no bytes in it
+    ElfPut64(file, address);
+    ElfPut64(file, address);
+    ElfPut64(file, file_size);
+    ElfPut64(file, mem_size);
+    ElfPut64(file, 0x1000);
+}
+
+// Writes the program as an executable. Returns false if the file can not be written.
+bool WriteExecutable(const char *path, const Interner *names, SymbolTable *symbolTable, TreeNode *root) {
+    JitCode jit_code(symbolTable->num_vars);
+    JitCode *pj = &jit_code;
+    ElfRuntime rt;
+    EmitElfRuntime(pj, names, &rt);
+
+    int program = pj->code.size();
+    CompileJit(pj, root);
+
+    int entry = pj->code.size();
+    pj->Load(R12, JitImmediate(ELF_DATA_ADDRESS));
+    pj->InstMem(0xc7, 0, R12, ELF_OUT_FD); // mov dword [r12 + out_fd], 1
+    pj->Int32(1);
+    pj->Load(RDI, JitImmediate(ELF_DATA_ADDRESS + ELF_STATE_SIZE));
+    pj->Inst(0x89, R12, JitRegister(RSI), true); // mov rsi, r12
+    pj->CallTo(program);
+    pj->Load(RDI, JitRegister(RAX));
+    pj->CallTo(rt.exit);
+
+    if (ElfAddress(pj->code.size()) > ELF_DATA_ADDRESS) {
+        fprintf(stderr, "The program is too large for an executable\n");
+        return false;
+    }
+
+    vector<unsigned char> file;
+    static const unsigned char ident[16] = {0x7f, 'E', 'L', 'F', 2, 1, 1}; // 64-bit, little endian, version 1
+    file.insert(file.end(), ident, ident + 16);
+    ElfPut16(&file, 2); // executable
+    ElfPut16(&file, 62); // x86-64
+    ElfPut32(&file, 1);
+    ElfPut64(&file, ElfAddress(entry));
+    ElfPut64(&file, 64); // program headers
+    ElfPut64(&file, 0); // no section headers
+    ElfPut32(&file, 0);
+    ElfPut16(&file, 64);
+    ElfPut16(&file, 56);
+    ElfPut16(&file, ELF_NUM_SEGMENTS);
+    ElfPut16(&file, 64);
+    ElfPut16(&file, 0);
+    ElfPut16(&file, 0);
+
+    unsigned long long text_size = ELF_HEADERS_SIZE + pj->code.size();
+    ElfSegment(&file, 1, 5, ELF_TEXT_ADDRESS, text_size, text_size); // PT_LOAD, read and execute
+    ElfSegment(&file, 1, 6, ELF_DATA_ADDRESS, 0, ELF_STATE_SIZE + 4 * (pj->num_vars + pj->num_temps)); // read, write
+    ElfSegment(&file, 0x6474e551, 6, 0, 0, 0); // PT_GNU_STACK, read and write
+    file.insert(file.end(), pj->code.begin(), pj->code.end());
+
+    FILE *out = fopen(path, "wb");
+    if (!out) {
+        fprintf(stderr, "Can not write %s\n", path);
+        return false;
+    }
+    bool ok = fwrite(&file[0], 1, file.size(), out) == file.size();
+    ok = fclose(out) == 0 && ok;
+#ifndef _WIN32
+    chmod(path, 0755);
+#endif
+    if (!ok) fprintf(stderr, "Can not write %s\n", path);
+    return ok;
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+// Assembly ////////////////////////////////////////////////////////////////////////
+
+// The checked tree as GNU as source for x86-64 Linux (simulation.s, Intel syntax), built without a compiler by
+// as -o simulation.o simulation.s && ld -o simulation simulation.o. The code is that of the JIT section, except
+// that the variables live in registers: a linear scan over their live ranges gives each variable one register of
+// asm_var_regs for its whole range, or its slot in tiny_vars when the registers run out. The runtime is the one of
+// the ELF section written as text.
+
+// The registers by JitReg, 32-bit and 64-bit
+const char *const AsmReg32Str[] = {
+        "eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi", "r8d", "r9d", "r10d", "r11d", "r12d", "r13d", "r14d",
+        "r15d"
+};
+const char *const AsmReg64Str[] = {
+        "rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi", "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15"
+};
+
+// The jcc and setcc suffixes by JitCond
+const char *const AsmCondStr[] = {"o", "no", "b", "ae", "e", "ne", "be", "a", "s", "ns", "p", "np", "l", "ge", "le",
+                                  "g"};
+
+// The registers of the variables. The runtime does not use them, and the program is not called by anything that
+// needs them kept. The values of expressions are in jit_regs as in the JIT.
+const JitReg asm_var_regs[] = {RBX, RBP, R12, R13, R14, R15};
+#define ASM_NUM_VAR_REGS 6
+
+// The runtime, with the behavior of the ELF section's. Its functions use only rax, rcx, rdx, rsi, rdi and r8-r11.
+const char *const asm_runtime_code =
+        "    .bss\n"
+        "tiny_out_buf: .zero 4096\n"
+        "tiny_in_buf: .zero 4096\n"
+        "tiny_out_len: .zero 4\n"
+        "tiny_in_pos: .zero 4\n"
+        "tiny_in_len: .zero 4\n"
+        "tiny_input_failed: .zero 4\n"
+        "    .data\n"
+        "tiny_out_fd: .long 1\n"
+        "    .section .rodata\n"
+        "tiny_enter: .ascii \"Enter \"\n"
+        "tiny_colon: .ascii \": \"\n"
+        "tiny_newline: .ascii \"\\n\"\n"
+        "tiny_error_at: .ascii \"Error at line \"\n"
+        "    .text\n"
+        "\n"
+        "# writes the output buffer to tiny_out_fd, the output is lost when it can not be written\n"
+        "tiny_flush:\n"
+        "    mov edx, DWORD PTR [rip + tiny_out_len]\n"
+        "    lea rsi, [rip + tiny_out_buf]\n"
+        "1:  test edx, edx\n"
+        "    je 2f\n"
+        "    mov eax, 1 # write\n"
+        "    mov edi, DWORD PTR [rip + tiny_out_fd]\n"
+        "    syscall\n"
+        "    test rax, rax\n"
+        "    jle 2f\n"
+        "    add rsi, rax\n"
+        "    sub edx, eax\n"
+        "    jmp 1b\n"
+        "2:  mov DWORD PTR [rip + tiny_out_len], 0\n"
+        "    ret\n"
+        "\n"
+        "# adds edx bytes at rsi to the output buffer\n"
+        "tiny_put:\n"
+        "    test edx, edx\n"
+        "    je 2f\n"
+        "    mov ecx, DWORD PTR [rip + tiny_out_len]\n"
+        "    cmp ecx, 4096\n"
+        "    jne 1f\n"
+        "    push rsi\n"
+        "    push rdx\n"
+        "    call tiny_flush\n"
+        "    pop rdx\n"
+        "    pop rsi\n"
+        "    xor ecx, ecx\n"
+        "1:  movzx eax, BYTE PTR [rsi]\n"
+        "    lea r8, [rip + tiny_out_buf]\n"
+        "    mov BYTE PTR [r8 + rcx], al\n"
+        "    inc ecx\n"
+        "    mov DWORD PTR [rip + tiny_out_len], ecx\n"
+        "    inc rsi\n"
+        "    dec edx\n"
+        "    jmp tiny_put\n"
+        "2:  ret\n"
+        "\n"
+        "# writes esi, the digits go backwards into 16 bytes of stack\n"
+        "tiny_put_int:\n"
+        "    sub rsp, 16\n"
+        "    mov eax, esi\n"
+        "    lea r8, [rsp + 16]\n"
+        "    test eax, eax\n"
+        "    jns 1f\n"
+        "    neg eax # the smallest int stays 2^31 unsigned\n"
+        "1:  mov ecx, 10\n"
+        "2:  xor edx, edx\n"
+        "    div ecx\n"
+        "    add edx, 48 # '0'\n"
+        "    dec r8\n"
+        "    mov BYTE PTR [r8], dl\n"
+        "    test eax, eax\n"
+        "    jne 2b\n"
+        "    test esi, esi\n"
+        "    jns 3f\n"
+        "    dec r8\n"
+        "    mov BYTE PTR [r8], 45 # '-'\n"
+        "3:  mov rsi, r8\n"
+        "    lea rdx, [rsp + 16]\n"
+        "    sub rdx, r8\n"
+        "    call tiny_put\n"
+        "    add rsp, 16\n"
+        "    ret\n"
+        "\n"
+        "# returns the next input byte, or -1 at the end\n"
+        "tiny_get_char:\n"
+        "    mov ecx, DWORD PTR [rip + tiny_in_pos]\n"
+        "    cmp ecx, DWORD PTR [rip + tiny_in_len]\n"
+        "    jl 2f\n"
+        "    xor eax, eax # read\n"
+        "    xor edi, edi # stdin\n"
+        "    lea rsi, [rip + tiny_in_buf]\n"
+        "    mov edx, 4096\n"
+        "    syscall\n"
+        "    test rax, rax\n"
+        "    jg 1f\n"
+        "    mov DWORD PTR [rip + tiny_in_len], 0\n"
+        "    mov DWORD PTR [rip + tiny_in_pos], 0\n"
+        "    mov eax, -1\n"
+        "    ret\n"
+        "1:  mov DWORD PTR [rip + tiny_in_len], eax\n"
+        "    xor ecx, ecx\n"
+        "2:  lea r8, [rip + tiny_in_buf]\n"
+        "    movzx eax, BYTE PTR [r8 + rcx]\n"
+        "    inc ecx\n"
+        "    mov DWORD PTR [rip + tiny_in_pos], ecx\n"
+        "    ret\n"
+        "\n"
+        "# returns the next number like RunState::ReadInt(), r9d is the sign and r10 the number\n"
+        "tiny_read_int:\n"
+        "    cmp DWORD PTR [rip + tiny_input_failed], 0\n"
+        "    je 1f\n"
+        "    xor eax, eax\n"
+        "    ret\n"
+        "1:  call tiny_get_char\n"
+        "    cmp eax, 32 # ' '\n"
+        "    je 1b\n"
+        "    lea ecx, [rax - 9] # '\\t' to '\\r'\n"
+        "    cmp ecx, 4\n"
+        "    jbe 1b\n"
+        "    xor r9d, r9d\n"
+        "    cmp eax, 45 # '-'\n"
+        "    jne 2f\n"
+        "    mov r9d, 1\n"
+        "    call tiny_get_char\n"
+        "    jmp 3f\n"
+        "2:  cmp eax, 43 # '+'\n"
+        "    jne 3f\n"
+        "    call tiny_get_char\n"
+        "3:  lea ecx, [rax - 48]\n"
+        "    cmp ecx, 9\n"
+        "    jbe 5f\n"
+        "    cmp eax, -1 # no number: give the byte back, fail and return 0\n"
+        "    je 4f\n"
+        "    dec DWORD PTR [rip + tiny_in_pos]\n"
+        "4:  mov DWORD PTR [rip + tiny_input_failed], 1\n"
+        "    xor eax, eax\n"
+        "    ret\n"
+        "5:  xor r10d, r10d\n"
+        "6:  cmp r10, 2147483647\n"
+        "    jg 7f\n"
+        "    imul r10, r10, 10\n"
+        "    add r10, rcx\n"
+        "7:  call tiny_get_char\n"
+        "    lea ecx, [rax - 48]\n"
+        "    cmp ecx, 9\n"
+        "    jbe 6b\n"
+        "    cmp eax, -1\n"
+        "    je 8f\n"
+        "    dec DWORD PTR [rip + tiny_in_pos]\n"
+        "8:  test r9d, r9d\n"
+        "    je 9f\n"
+        "    neg r10\n"
+        "9:  cmp r10, 2147483647 # out of range: fail and return the nearest int\n"
+        "    jg 10f\n"
+        "    cmp r10, -2147483648\n"
+        "    jl 11f\n"
+        "    mov eax, r10d\n"
+        "    ret\n"
+        "10: mov eax, 2147483647\n"
+        "    jmp 12f\n"
+        "11: mov eax, -2147483648\n"
+        "12: mov DWORD PTR [rip + tiny_input_failed], 1\n"
+        "    ret\n"
+        "\n"
+        "# flushes the output and exits with edi\n"
+        "tiny_exit:\n"
+        "    push rdi\n"
+        "    call tiny_flush\n"
+        "    pop rdi\n"
+        "    mov eax, 231 # exit_group\n"
+        "    syscall\n"
+        "\n"
+        "# prompts for the variable named by edx bytes at rsi and returns the number read\n"
+        "tiny_read:\n"
+        "    push rsi\n"
+        "    push rdx\n"
+        "    lea rsi, [rip + tiny_enter]\n"
+        "    mov edx, 6\n"
+        "    call tiny_put\n"
+        "    pop rdx\n"
+        "    pop rsi\n"
+        "    call tiny_put\n"
+        "    lea rsi, [rip + tiny_colon]\n"
+        "    mov edx, 2\n"
+        "    call tiny_put\n"
+        "    call tiny_flush\n"
+        "    jmp tiny_read_int\n"
+        "\n"
+        "# writes the variable named by edx bytes at rsi, whose value is ecx\n"
+        "tiny_write_var:\n"
+        "    push rcx\n"
+        "    call tiny_put\n"
+        "    lea rsi, [rip + tiny_colon]\n"
+        "    mov edx, 2\n"
+        "    call tiny_put\n"
+        "    pop rsi\n"
+        "\n"
+        "# writes esi on a line\n"
+        "tiny_write:\n"
+        "    call tiny_put_int\n"
+        "    lea rsi, [rip + tiny_newline]\n"
+        "    mov edx, 1\n"
+        "    jmp tiny_put\n"
+        "\n"
+        "# returns IntPow(edi, esi), a negative exponent gives 1, -1 or 0\n"
+        "tiny_pow:\n"
+        "    mov eax, 1\n"
+        "    test esi, esi\n"
+        "    jns 3f\n"
+        "    cmp edi, 1\n"
+        "    je 2f\n"
+        "    cmp edi, -1\n"
+        "    jne 1f\n"
+        "    test esi, 1\n"
+        "    je 2f\n"
+        "    mov eax, -1\n"
+        "    ret\n"
+        "1:  xor eax, eax\n"
+        "2:  ret\n"
+        "3:  test esi, esi\n"
+        "    je 2b\n"
+        "    test esi, 1\n"
+        "    je 4f\n"
+        "    imul eax, edi\n"
+        "4:  imul edi, edi\n"
+        "    shr esi, 1\n"
+        "    jmp 3b\n"
+        "\n"
+        "# stops the program after the output so far with the error at line esi, whose message is ecx bytes at rdx\n"
+        "tiny_error:\n"
+        "    push rdx\n"
+        "    push rcx\n"
+        "    push rsi\n"
+        "    call tiny_flush\n"
+        "    mov DWORD PTR [rip + tiny_out_fd], 2\n"
+        "    lea rsi, [rip + tiny_error_at]\n"
+        "    mov edx, 14\n"
+        "    call tiny_put\n"
+        "    pop rsi\n"
+        "    call tiny_put_int\n"
+        "    lea rsi, [rip + tiny_colon]\n"
+        "    mov edx, 2\n"
+        "    call tiny_put\n"
+        "    pop rdx\n"
+        "    pop rsi\n"
+        "    call tiny_put\n"
+        "    lea rsi, [rip + tiny_newline]\n"
+        "    mov edx, 1\n"
+        "    call tiny_put\n"
+        "    mov edi, 1\n"
+        "    jmp tiny_exit\n"
+        "\n";
+
+// The live range of a variable over the positions of the program. Statement n has two: 2 * n where its
+// expressions are read, then 2 * n + 1 where it sets its variable.
+struct LiveRange {
+    int id; // the name
+    int start;
+    int end;
+    bool seen;
+    bool defined; // the range starts where the variable is set on every path, its value before does not matter
+};
+
+// A repeat statement whose positions are being numbered
+struct LoopRange {
+    int start; // the position of the body
+    int id;
+    vector<int> slots; // the variables seen in it
+};
+
+struct AsmCode {
+    FILE *file;
+    const Interner *names;
+    int num_vars;
+    int num_temps; // see JitCode
+    int num_labels;
+    vector<JitOperand> vars; // where each variable is: a register or its slot
+    vector<JitErrorStub> stubs; // patch is the label of the stub
+    vector<bool> names_used; // the ids whose names read and write show
+
+    // see FindLiveRanges()
+    vector<LiveRange> ranges;
+    vector<LoopRange> loops;
+    vector<int> loop_seen; // the id of the last loop each variable was added to
+    int num_loops;
+    int if_depth;
+    vector<TreeNode *> nodes;
+
+    vector<pair<TreeNode *, int> > expr_stack; // see EmitAsmExpr()
+    vector<JitOperand> values;
+
+    AsmCode(FILE *_file, const Interner *_names, int _num_vars) {
+        file = _file;
+        names = _names;
+        num_vars = _num_vars;
+        num_temps = 0;
+        num_labels = 0;
+        names_used.assign(names->NumIds(), false);
+        LiveRange range = {0, 0, 0, false, false};
+        ranges.assign(num_vars, range);
+        loop_seen.assign(num_vars, -1);
+        num_loops = 0;
+        if_depth = 0;
+        int i;
+        for (i = 0; i < num_vars; i++) {
+            JitOperand var = {JIT_MEM, i};
+            vars.push_back(var);
+        }
+    }
+
+    void Operand(JitOperand a) {
+        if (a.kind == JIT_IMM) fprintf(file, "%d", a.value);
+        else if (a.kind == JIT_REG) fprintf(file, "%s", AsmReg32Str[a.value]);
+        else fprintf(file, "DWORD PTR [rip + tiny_vars + %d]", 4 * a.value);
+    }
+
+    void Inst(const char *op, JitOperand a) {
+        fprintf(file, "    %s ", op);
+        Operand(a);
+        fprintf(file, "\n");
+    }
+
+    void Inst(const char *op, JitOperand a, JitOperand b) {
+        fprintf(file, "    %s ", op);
+        Operand(a);
+        fprintf(file, ", ");
+        Operand(b);
+        fprintf(file, "\n");
+    }
+
+    int NewLabel() {
+        return num_labels++;
+    }
+
+    void Label(int label) {
+        fprintf(file, ".L%d:\n", label);
+    }
+
+    void Jump(int label) {
+        fprintf(file, "    jmp .L%d\n", label);
+    }
+
+    void JumpIf(JitCond cond, int label) {
+        fprintf(file, "    j%s .L%d\n", AsmCondStr[cond], label);
+    }
+
+    // mov r32, operand
+    void Load(int r, JitOperand a) {
+        if (a.kind != JIT_REG || a.value != r) Inst("mov", JitRegister(r), a);
+    }
+
+    // cmp a, b, where a is not an immediate
+    void Compare(JitOperand a, JitOperand b) {
+        if (a.kind == JIT_MEM && b.kind == JIT_MEM) {
+            Load(RAX, a);
+            a = JitRegister(RAX);
+        }
+        Inst("cmp", a, b);
+    }
+
+    // The address and length of a name in rsi and edx, the arguments of tiny_read and tiny_write_var
+    void LoadName(int id) {
+        names_used[id] = true;
+        fprintf(file, "    lea rsi, [rip + tiny_name_%d]\n", id);
+        Load(RDX, JitImmediate(names->NameLen(id)));
+    }
+};
+
+// Extends the live range of a variable to a position where it is read, or set
+void SeeVariable(AsmCode *pa, TreeNode *node, int pos, bool set) {
+    int slot = node->var->memloc;
+    LiveRange *pr = &pa->ranges[slot];
+    if (!pr->seen) {
+        pr->id = node->id;
+        pr->seen = true;
+        pr->defined = set && pa->if_depth == 0;
+        pr->start = pr->defined ? pos : 0;
+    }
+    pr->end = max(pr->end, pos);
+
+    if (!pa->loops.empty() && pa->loop_seen[slot] != pa->loops.back().id) {
+        pa->loop_seen[slot] = pa->loops.back().id;
+        pa->loops.back().slots.push_back(slot);
+    }
+}
+
+void SeeExpr(AsmCode *pa, TreeNode *expr, int pos) {
+    vector<TreeNode *> &stack = pa->nodes;
+    stack.clear();
+    stack.push_back(expr);
+    while (!stack.empty()) {
+        TreeNode *node = stack.back();
+        stack.pop_back();
+        if (node->node_kind == ID_NODE) SeeVariable(pa, node, pos, false);
+        else if (node->node_kind == OPER_NODE) {
+            stack.push_back(node->child[1]);
+            stack.push_back(node->child[0]);
+        }
+    }
+}
+
+// Ends the innermost loop at its condition. A variable seen in it that is not set first in the loop (on every
+// path) may carry its value around, so its range goes on to the end of the loop.
+void EndLoop(AsmCode *pa, int end) {
+    LoopRange *pl = &pa->loops.back();
+    size_t i;
+    for (i = 0; i < pl->slots.size(); i++) {
+        LiveRange *pr = &pa->ranges[pl->slots[i]];
+        if (!pr->defined || pr->start < pl->start) pr->end = max(pr->end, end);
+    }
+    if (pa->loops.size() > 1) {
+        vector<int> &outer = pa->loops[pa->loops.size() - 2].slots;
+        outer.insert(outer.end(), pl->slots.begin(), pl->slots.end());
+    }
+    pa->loops.pop_back();
+}
+
+// Numbers the positions of the statements from root on, in the order of the code, and finds the live range of
+// each variable. A range that starts before a loop and reaches into it covers the whole loop, and so does one that
+// starts in it without setting the variable first.
+void FindLiveRanges(AsmCode *pa, TreeNode *root) {
+    struct RangeFrame {
+        TreeNode *node;
+        int state;
+    };
+    vector<RangeFrame> stack;
+    RangeFrame frame = {root, 0};
+    stack.push_back(frame);
+    int n = 0;
+
+    while (!stack.empty()) {
+        RangeFrame *pf = &stack.back();
+        TreeNode *node = pf->node;
+        if (!node) {
+            stack.pop_back();
+            continue;
+        }
+
+        RangeFrame next = {node->sibling, 0};
+        switch (node->node_kind) {
+            case IF_NODE:
+                if (pf->state == 0) {
+                    SeeExpr(pa, node->child[0], 2 * n++);
+                    pa->if_depth++;
+                    pf->state = 1;
+                    frame.node = node->child[1];
+                    stack.push_back(frame);
+                } else if (pf->state == 1 && node->child[2]) {
+                    pf->state = 2;
+                    frame.node = node->child[2];
+                    stack.push_back(frame);
+                } else {
+                    pa->if_depth--;
+                    *pf = next;
+                }
+                break;
+            case REPEAT_NODE:
+                if (pf->state == 0) {
+                    LoopRange loop;
+                    loop.start = 2 * n;
+                    loop.id = pa->num_loops++;
+                    pa->loops.push_back(loop);
+                    pf->state = 1;
+                    frame.node = node->child[0];
+                    stack.push_back(frame);
+                } else {
+                    int pos = 2 * n++;
+                    SeeExpr(pa, node->child[1], pos);
+                    EndLoop(pa, pos);
+                    *pf = next;
+                }
+                break;
+            case ASSIGN_NODE: {
+                int pos = 2 * n++;
+                SeeExpr(pa, node->child[0], pos);
+                SeeVariable(pa, node, pos + 1, true);
+                *pf = next;
+                break;
+            }
+            case READ_NODE:
+                SeeVariable(pa, node, 2 * n++ + 1, true);
+                *pf = next;
+                break;
+            case WRITE_NODE:
+                SeeExpr(pa, node->child[0], 2 * n++);
+                *pf = next;
+                break;
+            default:
+                *pf = next;
+                break;
+        }
+    }
+}
+
+// Linear scan: the ranges in the order of their starts take the free registers of asm_var_regs. When there is
+// none, the range that ends last, this one or one that holds a register, stays in memory.
+void AllocateRegisters(AsmCode *pa) {
+    vector<pair<int, int> > order; // start, slot
+    int slot;
+    for (slot = 0; slot < pa->num_vars; slot++)
+        if (pa->ranges[slot].seen) order.push_back(make_pair(pa->ranges[slot].start, slot));
+    sort(order.begin(), order.end());
+
+    int active[ASM_NUM_VAR_REGS]; // the slot in each register, or -1
+    int r;
+    for (r = 0; r < ASM_NUM_VAR_REGS; r++) active[r] = -1;
+
+    size_t i;
+    for (i = 0; i < order.size(); i++) {
+        slot = order[i].second;
+        int free = -1, last = -1;
+        for (r = 0; r < ASM_NUM_VAR_REGS; r++) {
+            if (active[r] >= 0 && pa->ranges[active[r]].end < order[i].first) active[r] = -1;
+            if (active[r] < 0) {
+                if (free < 0) free = r;
+            } else if (last < 0 || pa->ranges[active[r]].end > pa->ranges[active[last]].end) last = r;
+        }
+        if (free < 0 && pa->ranges[active[last]].end > pa->ranges[slot].end) {
+            JitOperand var = {JIT_MEM, active[last]};
+            pa->vars[active[last]] = var;
+            free = last;
+        }
+        if (free >= 0) {
+            active[free] = slot;
+            pa->vars[slot] = JitRegister(asm_var_regs[free]);
+        }
+    }
+}
+
+// eax = a / b, see EmitJitDivide()
+void EmitAsmDivide(AsmCode *pa, TreeNode *node, JitOperand a, JitOperand b) {
+    bool safe = b.kind == JIT_IMM && b.value != 0 && b.value != -1;
+    if (b.kind == JIT_IMM) {
+        pa->Load(R11, b);
+        b = JitRegister(R11);
+    }
+    pa->Load(RAX, a);
+
+    if (!safe) {
+        JitErrorStub stub = {pa->NewLabel(), node->line_num, JIT_DIVISION_BY_ZERO};
+        pa->Compare(b, JitImmediate(0));
+        pa->JumpIf(JIT_E, stub.patch);
+        pa->stubs.push_back(stub);
+
+        int skip = pa->NewLabel();
+        pa->Compare(b, JitImmediate(-1));
+        pa->JumpIf(JIT_NE, skip);
+        stub.patch = pa->NewLabel();
+        stub.error = JIT_DIVISION_OVERFLOW;
+        pa->Compare(JitRegister(RAX), JitImmediate(INT_MIN));
+        pa->JumpIf(JIT_E, stub.patch);
+        pa->stubs.push_back(stub);
+        pa->Label(skip);
+    }
+
+    fprintf(pa->file, "    cdq\n");
+    pa->Inst("idiv", b);
+}
+
+// eax = IntPow(a, b), saving the registers of the values below depth i
+void EmitAsmPower(AsmCode *pa, JitOperand a, JitOperand b, int i) {
+    int live = min(i, JIT_NUM_REGS), j;
+    for (j = 0; j < live; j++) fprintf(pa->file, "    push %s\n", AsmReg64Str[jit_regs[j]]);
+
+    // a or b may be in edi or esi
+    pa->Load(R11, b);
+    pa->Load(RDI, a);
+    pa->Load(RSI, JitRegister(R11));
+    fprintf(pa->file, "    call tiny_pow\n");
+
+    for (j = live - 1; j >= 0; j--) fprintf(pa->file, "    pop %s\n", AsmReg64Str[jit_regs[j]]);
+}
+
+// eax = MagicDivide(a, magic), see EmitJitMagicDivide()
+void EmitAsmMagicDivide(AsmCode *pa, JitOperand a, DivisionMagic magic) {
+    fprintf(pa->file, "    movsxd r11, ");
+    pa->Operand(a);
+    fprintf(pa->file, "\n    imul rax, r11, %d\n", magic.multiplier);
+    if (magic.multiplier >= 0) fprintf(pa->file, "    sar rax, %d\n", 32 + magic.shift);
+    else {
+        fprintf(pa->file, "    sar rax, 32\n    add eax, r11d\n");
+        if (magic.shift) fprintf(pa->file, "    sar eax, %d\n", magic.shift);
+    }
+    fprintf(pa->file, "    shr r11d, 31\n    add eax, r11d\n");
+}
+
+// Emits node's operation of a and b like EmitJitOper(). The value goes to the register dest when it is not -1 and
+// not b.
+JitOperand EmitAsmOper(AsmCode *pa, TreeNode *node, JitOperand a, JitOperand b, int i, int dest) {
+    TokenType oper = node->oper;
+    if (a.kind == JIT_IMM && b.kind == JIT_IMM &&
+        !(oper == DIVIDE && (b.value == 0 || (b.value == -1 && a.value == INT_MIN)))) {
+        JitOperand result = {JIT_IMM, Operate(node, a.value, b.value)};
+        return result;
+    }
+
+    // the number on the right of + * and =, and x := y + x adds y to x
+    bool commutes = oper == PLUS || oper == TIMES || oper == EQUAL;
+    if (commutes && (a.kind == JIT_IMM || (dest >= 0 && b.kind == JIT_REG && b.value == dest))) swap(a, b);
+
+    int w = i < JIT_NUM_REGS ? jit_regs[i] : RAX;
+    if (dest >= 0 && (b.kind != JIT_REG || b.value != dest)) w = dest;
+    switch (oper) {
+        case PLUS:
+        case MINUS:
+            pa->Load(w, a);
+            pa->Inst(oper == PLUS ? "add" : "sub", JitRegister(w), b);
+            break;
+        case TIMES:
+            if (b.kind == JIT_IMM) {
+                fprintf(pa->file, "    imul %s, ", AsmReg32Str[w]);
+                pa->Operand(a);
+                fprintf(pa->file, ", %d\n", b.value);
+            } else {
+                pa->Load(w, a);
+                pa->Inst("imul", JitRegister(w), b);
+            }
+            break;
+        case DIVIDE:
+            EmitAsmDivide(pa, node, a, b);
+            pa->Load(w, JitRegister(RAX));
+            break;
+        case POWER:
+            EmitAsmPower(pa, a, b, i);
+            pa->Load(w, JitRegister(RAX));
+            break;
+        case SHIFT_LEFT:
+            pa->Load(w, a);
+            pa->Inst("shl", JitRegister(w), b);
+            break;
+        case SHIFT_DIVIDE:
+            pa->Load(w, a);
+            fprintf(pa->file, "    mov r11d, %s\n    sar r11d, 31\n    shr r11d, %d\n", AsmReg32Str[w], 32 - b.value);
+            fprintf(pa->file, "    add %s, r11d\n    sar %s, %d\n", AsmReg32Str[w], AsmReg32Str[w], b.value);
+            break;
+        case MAGIC_DIVIDE:
+            EmitAsmMagicDivide(pa, a, MakeDivisionMagic(b.value));
+            pa->Load(w, JitRegister(RAX));
+            break;
+        case CONST_POWER: {
+            pa->Load(R11, a);
+            pa->Load(w, b.value ? JitRegister(R11) : JitImmediate(1));
+            int bit = 30;
+            while (bit > 0 && !(b.value >> bit & 1)) bit--;
+            for (bit--; bit >= 0; bit--) {
+                pa->Inst("imul", JitRegister(w), JitRegister(w));
+                if (b.value >> bit & 1) pa->Inst("imul", JitRegister(w), JitRegister(R11));
+            }
+            break;
+        }
+        default:
+            pa->Load(w, a);
+            pa->Compare(JitRegister(w), b);
+            fprintf(pa->file, "    set%s al\n", AsmCondStr[oper == LESS_THAN ? JIT_L : JIT_E]);
+            fprintf(pa->file, "    movzx %s, al\n", AsmReg32Str[w]);
+            break;
+    }
+
+    JitOperand result = {JIT_REG, w};
+    if (w == RAX) {
+        result.kind = JIT_MEM;
+        result.value = pa->num_vars + i;
+        if (i + 1 > pa->num_temps) pa->num_temps = i + 1;
+        pa->Inst("mov", result, JitRegister(RAX));
+    }
+    return result;
+}
+
+// Emits the code of an expression whose values start at depth base like EmitJitExpr(). The value of the whole
+// expression goes to the register dest if it is not -1 and that is possible.
+JitOperand EmitAsmExpr(AsmCode *pa, TreeNode *expr, int base, int dest = -1) {
+    vector<pair<TreeNode *, int> > &stack = pa->expr_stack;
+    vector<JitOperand> &values = pa->values;
+    stack.clear();
+    values.clear();
+    stack.push_back(make_pair(expr, 0));
+
+    while (!stack.empty()) {
+        TreeNode *node = stack.back().first;
+        int i = stack.back().second;
+
+        if (node->node_kind == OPER_NODE && i < 2) {
+            stack.back().second++;
+            stack.push_back(make_pair(node->child[i], 0));
+            continue;
+        }
+        stack.pop_back();
+
+        JitOperand value = {JIT_IMM, 0};
+        if (node->node_kind == NUM_NODE) value.value = node->num;
+        else if (node->node_kind == ID_NODE) value = pa->vars[node->var->memloc];
+        else {
+            JitOperand b = values.back();
+            values.pop_back();
+            JitOperand a = values.back();
+            values.pop_back();
+            value = EmitAsmOper(pa, node, a, b, base + values.size(), node == expr ? dest : -1);
+        }
+        values.push_back(value);
+    }
+    return values.back();
+}
+
+// Emits a jump to label when the condition is false, like EmitJitJumpIfFalse()
+void EmitAsmJumpIfFalse(AsmCode *pa, TreeNode *cond, int label) {
+    if (cond->node_kind != OPER_NODE || (cond->oper != LESS_THAN && cond->oper != EQUAL)) {
+        JitOperand value = EmitAsmExpr(pa, cond, 0);
+        if (value.kind == JIT_IMM) {
+            if (!value.value) pa->Jump(label);
+            return;
+        }
+        pa->Compare(value, JitImmediate(0));
+        pa->JumpIf(JIT_E, label);
+        return;
+    }
+
+    JitOperand a = EmitAsmExpr(pa, cond->child[0], 0);
+    JitOperand b = EmitAsmExpr(pa, cond->child[1], 1);
+    bool less = cond->oper == LESS_THAN;
+    if (a.kind == JIT_IMM && b.kind == JIT_IMM) {
+        bool value = less ? a.value < b.value : a.value == b.value;
+        if (!value) pa->Jump(label);
+        return;
+    }
+
+    JitCond jump = less ? JIT_GE : JIT_NE;
+    if (a.kind == JIT_IMM) {
+        swap(a, b);
+        if (less) jump = JIT_LE;
+    }
+    pa->Compare(a, b);
+    pa->JumpIf(jump, label);
+}
+
+// Emits the entry point: the statements from root on, with the frames of CompileProgram(), then the exit and the
+// error stubs
+void CompileAsm(AsmCode *pa, TreeNode *root) {
+    FILE *file = pa->file;
+    fprintf(file, "    .globl _start\n_start:\n");
+    int slot;
+    for (slot = 0; slot < pa->num_vars; slot++) {
+        JitOperand var = pa->vars[slot];
+        if (var.kind != JIT_REG) continue;
+        fprintf(file, "    # %s: %s\n", pa->names->Name(pa->ranges[slot].id), AsmReg32Str[var.value]);
+        if (!pa->ranges[slot].defined) pa->Inst("xor", var, var); // memory starts zeroed, registers do not
+    }
+
+    struct CodeFrame {
+        TreeNode *node;
+        int state;
+        int label;
+    };
+    vector<CodeFrame> stack;
+    CodeFrame frame = {root, 0, 0};
+    stack.push_back(frame);
+
+    while (!stack.empty()) {
+        CodeFrame *pf = &stack.back();
+        TreeNode *node = pf->node;
+        if (!node) {
+            stack.pop_back();
+            continue;
+        }
+        if (pf->state == 0) fprintf(file, "    # line %d\n", node->line_num);
+
+        CodeFrame next = {node->sibling, 0, 0};
+        switch (node->node_kind) {
+            case IF_NODE:
+                if (pf->state == 0) {
+                    pf->label = pa->NewLabel();
+                    EmitAsmJumpIfFalse(pa, node->child[0], pf->label);
+                    pf->state = 1;
+                    frame.node = node->child[1];
+                    stack.push_back(frame);
+                } else if (pf->state == 1 && node->child[2]) {
+                    int end = pa->NewLabel();
+                    pa->Jump(end);
+                    pa->Label(pf->label);
+                    pf->label = end;
+                    pf->state = 2;
+                    frame.node = node->child[2];
+                    stack.push_back(frame);
+                } else {
+                    pa->Label(pf->label);
+                    *pf = next;
+                }
+                break;
+            case REPEAT_NODE:
+                if (pf->state == 0) {
+                    pf->label = pa->NewLabel();
+                    pa->Label(pf->label);
+                    pf->state = 1;
+                    frame.node = node->child[0];
+                    stack.push_back(frame);
+                } else {
+                    EmitAsmJumpIfFalse(pa, node->child[1], pf->label);
+                    *pf = next;
+                }
+                break;
+            case ASSIGN_NODE: {
+                JitOperand var = pa->vars[node->var->memloc];
+                if (var.kind == JIT_REG) {
+                    JitOperand value = EmitAsmExpr(pa, node->child[0], 0, var.value);
+                    pa->Load(var.value, value);
+                } else {
+                    JitOperand value = EmitAsmExpr(pa, node->child[0], 0);
+                    if (value.kind == JIT_MEM) {
+                        pa->Load(RAX, value);
+                        value = JitRegister(RAX);
+                    }
+                    pa->Inst("mov", var, value);
+                }
+                *pf = next;
+                break;
+            }
+            case READ_NODE: {
+                JitOperand var = pa->vars[node->var->memloc];
+                pa->LoadName(node->id);
+                fprintf(file, "    call tiny_read\n");
+                pa->Inst("mov", var, JitRegister(RAX));
+                *pf = next;
+                break;
+            }
+            case WRITE_NODE: {
+                TreeNode *expr = node->child[0];
+                JitOperand value = EmitAsmExpr(pa, expr, 0);
+                if (expr->node_kind == ID_NODE) {
+                    pa->Load(RCX, value);
+                    pa->LoadName(expr->id);
+                    fprintf(file, "    call tiny_write_var\n");
+                } else {
+                    pa->Load(RSI, value);
+                    fprintf(file, "    call tiny_write\n");
+                }
+                *pf = next;
+                break;
+            }
+            default:
+                *pf = next;
+                break;
+        }
+    }
+
+    fprintf(file, "    xor edi, edi\n    jmp tiny_exit\n");
+    size_t i;
+    for (i = 0; i < pa->stubs.size(); i++) {
+        pa->Label(pa->stubs[i].patch);
+        pa->Load(RSI, JitImmediate(pa->stubs[i].line_num));
+        fprintf(file, "    lea rdx, [rip + tiny_error_%d]\n", pa->stubs[i].error);
+        pa->Load(RCX, JitImmediate(strlen(JitErrorStr[pa->stubs[i].error])));
+        fprintf(file, "    jmp tiny_error\n");
+    }
+}
+
+// Writes the program as GNU as source. Returns false if the file can not be written.
+bool WriteAssembly(const char *path, const Interner *names, SymbolTable *symbolTable, TreeNode *root) {
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        fprintf(stderr, "Can not write %s\n", path);
+        return false;
+    }
+
+    AsmCode asm_code(file, names, symbolTable->num_vars);
+    AsmCode *pa = &asm_code;
+    FindLiveRanges(pa, root);
+    AllocateRegisters(pa);
+
+    fprintf(file, "# build with: as -o simulation.o %s && ld -o simulation simulation.o\n", path);
+    fprintf(file, "    .intel_syntax noprefix\n");
+    fputs(asm_runtime_code, file);
+    CompileAsm(pa, root);
+
+    fprintf(file, "\n    .section .rodata\n");
+    int i;
+    for (i = 0; i < 2; i++) fprintf(file, "tiny_error_%d: .ascii \"%s\"\n", i, JitErrorStr[i]);
+    for (i = 0; i < names->NumIds(); i++)
+        if (pa->names_used[i]) fprintf(file, "tiny_name_%d: .ascii \"%s\"\n", i, names->Name(i));
+    fprintf(file, "    .bss\n    .align 4\ntiny_vars: .zero %d\n", 4 * (pa->num_vars + pa->num_temps));
+
+    bool ok = !ferror(file);
+    ok = fclose(file) == 0 && ok;
+    if (!ok) fprintf(stderr, "Can not write %s\n", path);
+    return ok;
+}
+
+// How -run runs the program
+enum RunEngine {RUN_TREE, RUN_STACK, RUN_REGISTER, RUN_JIT};
+
+// Runs the program on stdin and stdout. Returns false if it stopped with an error, which is shown on stderr.
+bool RunProgram(SymbolTable *symbolTable, TreeNode *root, RunEngine engine) {
+    RunState state(symbolTable, stdin, stdout);
+    try {
+        if (engine == RUN_TREE) {
+            Interpreter interpreter;
+            interpreter.state = &state;
+            Execute(&interpreter, root);
+        } else if (engine == RUN_STACK) {
+            Bytecode bytecode;
+            CompileProgram(&bytecode, root);
+            RunBytecode(&state, &bytecode);
+        } else if (engine == RUN_REGISTER) {
+            RegCode reg_code(symbolTable->num_vars);
+            CompileRegProgram(&reg_code, root);
+            RunRegisters(&state, &reg_code);
+        } else {
+#ifdef TINY_HAVE_JIT
+            JitCode jit_code(symbolTable->num_vars);
+            CompileJit(&jit_code, root);
+            RunJit(&state, &jit_code);
+#endif
+        }
+    } catch (RunError error) {
+        fflush(stdout);
+        fprintf(stderr, "Error at line %d: %s\n", error.line_num, error.message);
+        return false;
+    }
+#if TINY_VM_STATS
+    fflush(stdout);
+    if (engine == RUN_STACK) vm_stats.Print(OpCodeStr, NUM_OPCODES);
+    if (engine == RUN_REGISTER) vm_stats.Print(RegOpCodeStr, NUM_REG_OPCODES);
+#endif
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+// Flat Tree ///////////////////////////////////////////////////////////////////////
+
+// The syntax tree stored in arrays in preorder (node, its children, then its siblings) with 32-bit indices
+// instead of pointers. The fields that the passes branch on are packed in FlatNode, the line numbers and the
+// identifier ids/numbers are in separate arrays that are only read when needed.
+// The children of a node are found from the subtree ends: the first child is the next node, and every other
+// child starts where the previous child, with all its siblings, ends. A node's sibling starts where the node's
+// subtree ends.
+
+#define FLAT_HAS_SIBLING 1
+#define FLAT_FIRST_USE 2 // see TreeNode::first_use
+
+struct FlatNode {
+    unsigned char kind; // NodeKind
+    unsigned char oper; // TokenType of OPER_NODE
+    unsigned char type; // ExprDataType
+    unsigned char flags; // FLAT_HAS_SIBLING, FLAT_FIRST_USE
+    unsigned end; // index after the subtree of the node (its children, not its siblings)
+};
+
+// The arrays are in the vectors when the tree is built by FlattenTree(), or in a mapped cache file
+// (see LoadCache()), so the passes only use the pointers.
+struct FlatTree {
+    FlatNode *nodes;
+    int *line_num;
+    int *value; // id of identifier/read/assign nodes, number of NUM_NODE
+    int *slot; // slot of identifier/read/assign nodes, see AnnotateSlots()
+    unsigned size;
+    vector<ReportedTypeError> type_errors; // the errors reported by Analyze(), in order
+
+    vector<FlatNode> node_buf;
+    vector<int> line_num_buf, value_buf, slot_buf;
+
+    FlatTree() {
+        nodes = 0;
+        line_num = value = slot = 0;
+        size = 0;
+    }
+
+    unsigned Size() const { return size; }
+
+    // points the arrays at the vectors, after nodes were added to them
+    void UseBuffers() {
+        nodes = node_buf.data();
+        line_num = line_num_buf.data();
+        value = value_buf.data();
+        slot = slot_buf.data();
+        size = node_buf.size();
+    }
+
+    // index after the node and all the siblings that follow it
+    unsigned SeqEnd(unsigned i) const {
+        while (nodes[i].flags & FLAT_HAS_SIBLING) i = nodes[i].end;
+        return nodes[i].end;
+    }
+
+    // Sets the indices of the children of node i, 0 for the missing ones (0 is the root, never a child)
+    void Children(unsigned i, unsigned child[MAX_CHILDREN]) const {
+        unsigned next = i + 1;
+        int k;
+        for (k = 0; k < MAX_CHILDREN; k++) {
+            child[k] = next < nodes[i].end ? next : 0;
+            if (child[k]) next = SeqEnd(next);
+        }
+    }
+};
+
+// Copies the tree under root (and its siblings) into pflat
+void FlattenTree(TreeNode *root, FlatTree *pflat) {
+    // nodes to copy; a node with close set marks the end of the subtree of index close
+    struct FlattenItem {
+        TreeNode *node;
+        unsigned close;
+    };
+    vector<FlattenItem> stack;
+    FlattenItem item = {root, 0};
+    if (root) stack.push_back(item);
+
+    while (!stack.empty()) {
+        item = stack.back();
+        stack.pop_back();
+        if (!item.node) {
+            pflat->node_buf[item.close].end = pflat->node_buf.size();
+            continue;
+        }
+
+        TreeNode *node = item.node;
+        unsigned i = pflat->node_buf.size();
+        FlatNode flat_node;
+        flat_node.kind = node->node_kind;
+        flat_node.oper = node->node_kind == OPER_NODE ? node->oper : 0;
+        flat_node.type = node->expr_data_type;
+        flat_node.flags = (node->sibling ? FLAT_HAS_SIBLING : 0) | (node->first_use ? FLAT_FIRST_USE : 0);
+        flat_node.end = 0;
+        pflat->node_buf.push_back(flat_node);
+        pflat->line_num_buf.push_back(node->line_num);
+        pflat->value_buf.push_back(node->node_kind == NUM_NODE ? node->num : node->id);
+        pflat->slot_buf.push_back(node->var ? node->var->memloc : -1);
+
+        // the children, then the end of the subtree, then the sibling
+        FlattenItem next = {node->sibling, 0};
+        if (node->sibling) stack.push_back(next);
+        next.node = 0;
+        next.close = i;
+        stack.push_back(next);
+        int k;
+        for (k = MAX_CHILDREN - 1; k >= 0; k--) {
+            next.node = node->child[k];
+            if (next.node) stack.push_back(next);
+        }
+    }
+    pflat->UseBuffers();
+}
+
+void ReportTypeError(FlatTree *pflat, TypeError error, unsigned i) {
+    ReportedTypeError reported = {error, pflat->line_num[i]};
+    pflat->type_errors.push_back(reported);
+    PrintTypeError(error, reported.line_num);
+}
+
+// The passes below do the same as their TreeNode versions
+
+static void CheckNode(FlatTree *pflat, unsigned i);
+
+// Nodes are entered in preorder, which is the order of the nodes, and checked in postorder, when the scan
+// leaves their subtree. The open nodes are the ancestors of the current node.
+void Analyze(SymbolTable *symbolTable, FlatTree *pflat) {
+    vector<unsigned> open;
+    unsigned i;
+    for (i = 0; i <= pflat->Size(); i++) {
+        while (!open.empty() && (i == pflat->Size() || pflat->nodes[open.back()].end <= i)) {
+            CheckNode(pflat, open.back());
+            open.pop_back();
+        }
+        if (i == pflat->Size()) break;
+        open.push_back(i);
+
+        int kind = pflat->nodes[i].kind;
+        if (kind == ID_NODE || kind == ASSIGN_NODE || kind == READ_NODE) {
+            VariableInfo *var = symbolTable->Insert(pflat->value[i], pflat->line_num[i]);
+            if (var->first_line == pflat->line_num[i]) pflat->nodes[i].flags |= FLAT_FIRST_USE;
+        }
+    }
+}
+
+// The slots are only known when all variables are counted, so they are set after Analyze() and AssignSlots()
+void AnnotateSlots(SymbolTable *symbolTable, FlatTree *pflat) {
+    unsigned i;
+    for (i = 0; i < pflat->Size(); i++) {
+        int kind = pflat->nodes[i].kind;
+        if (kind == ID_NODE || kind == ASSIGN_NODE || kind == READ_NODE)
+            pflat->slot[i] = symbolTable->Find(pflat->value[i])->memloc;
+    }
+}
+
+void CheckNode(FlatTree *pflat, unsigned i) {
+    FlatNode *node = &pflat->nodes[i];
+    unsigned child[MAX_CHILDREN];
+    pflat->Children(i, child);
+
+    switch (node->kind) {
+        case IF_NODE:
+            if (pflat->nodes[child[0]].type != BOOLEAN)
+                ReportTypeError(pflat, IF_TYPE_ERROR, i);
+            break;
+        case REPEAT_NODE:
+            if (pflat->nodes[child[1]].type != BOOLEAN)
+                ReportTypeError(pflat, REPEAT_TYPE_ERROR, i);
+            break;
+        case ASSIGN_NODE:
+            if (pflat->nodes[child[0]].type != INTEGER)
+                ReportTypeError(pflat, ASSIGN_TYPE_ERROR, i);
+            break;
+        case WRITE_NODE:
+            if (pflat->nodes[child[0]].type != INTEGER)
+                ReportTypeError(pflat, WRITE_TYPE_ERROR, i);
+            break;
+        case OPER_NODE:
+            if (pflat->nodes[child[0]].type != INTEGER || pflat->nodes[child[1]].type != INTEGER)
+                ReportTypeError(pflat, OPER_TYPE_ERROR, i);
+            if (node->oper == EQUAL || node->oper == LESS_THAN) node->type = BOOLEAN;
+            else node->type = INTEGER;
+            break;
+        case NUM_NODE:
+        case ID_NODE:
+            node->type = INTEGER;
+            break;
+        default:
+            break;
+    }
+}
+
+// preorder, indented by the number of open ancestors
+void PrintTree(const Interner *names, const FlatTree *pflat) {
+    vector<unsigned> open;
+    unsigned i;
+    int j, NSH = 3;
+    for (i = 0; i < pflat->Size(); i++) {
+        while (!open.empty() && pflat->nodes[open.back()].end <= i) open.pop_back();
+        open.push_back(i);
+
+        const FlatNode *node = &pflat->nodes[i];
+        for (j = 0; j < NSH * ((int) open.size() - 1); j++) printf(" ");
+
+        printf("[%s]", NodeKindStr[node->kind]);
+
+        if (node->kind == OPER_NODE) printf("[%s]", TokenTypeStr[node->oper]);
+        else if (node->kind == NUM_NODE) printf("[%d]", pflat->value[i]);
+        else if (node->kind == ID_NODE || node->kind == READ_NODE || node->kind == ASSIGN_NODE)
+            printf("[%s]", names->Name(pflat->value[i]));
+
+        if (node->type != VOID) printf("[%s]", ExprDataTypeStr[node->type]);
+
+        printf("\n");
+    }
+}
+
+void handleIdDatatype(FILE *file, const FlatTree *pflat, unsigned i) {
+    if (pflat->nodes[i].flags & FLAT_FIRST_USE)
+        fprintf(file, "int ");
+}
+
+// See the TreeNode version, items are node indices or text
+void SimulateNode(FILE *file, SymbolTable *symbolTable, const FlatTree *pflat) {
+    struct FlatSimulationItem {
+        unsigned node;
+        const char *text;
+    };
+    vector<FlatSimulationItem> stack;
+    FlatSimulationItem item = {0, 0};
+    if (pflat->Size()) stack.push_back(item);
+
+    while (!stack.empty()) {
+        item = stack.back();
+        stack.pop_back();
+        if (item.text) {
+            fprintf(file, "%s", item.text);
+            continue;
+        }
+
+        unsigned i = item.node;
+        const FlatNode *node = &pflat->nodes[i];
+        unsigned child[MAX_CHILDREN];
+        pflat->Children(i, child);
+
+        // pushed in reverse order: the sibling, then the parts of the node
+        FlatSimulationItem parts[8];
+        int num_parts = 0, k;
+        if (node->flags & FLAT_HAS_SIBLING) {
+            FlatSimulationItem sibling = {node->end, 0};
+            stack.push_back(sibling);
+        }
+
+        switch (node->kind) {
+            case IF_NODE:
+                fprintf(file, "if (");
+                parts[num_parts++] = {child[0], 0};
+                parts[num_parts++] = {0, ")\n{\n"};
+                parts[num_parts++] = {child[1], 0};
+                if (child[2]) {
+                    parts[num_parts++] = {0, "\n}\nelse\n{\n"};
+                    parts[num_parts++] = {child[2], 0};
+                }
+                parts[num_parts++] = {0, "\n}\n"};
+                break;
+            case REPEAT_NODE:
+                fprintf(file, "do {\n");
+                parts[num_parts++] = {child[0], 0};
+                parts[num_parts++] = {0, "} while(!("};
+                parts[num_parts++] = {child[1], 0};
+                parts[num_parts++] = {0, "));\n\n"};
+                break;
+            case ASSIGN_NODE:
+                handleIdDatatype(file, pflat, i);
+                fprintf(file, "%s = ", symbolTable->names->Name(pflat->value[i]));
+                parts[num_parts++] = {child[0], 0};
+                parts[num_parts++] = {0, ";\n"};
+                break;
+            case WRITE_NODE:
+                if (pflat->nodes[child[0]].kind == ID_NODE) {
+                    fprintf(file, "cout << \"%s: \"<< %s << \"\\n\";\n",
+                            symbolTable->names->Name(pflat->value[child[0]]),
+                            symbolTable->names->Name(pflat->value[child[0]]));
+                } else {
+                    fprintf(file, "cout << (");
+                    parts[num_parts++] = {child[0], 0};
+                    parts[num_parts++] = {0, ") << \"\\n\";\n"};
+                }
+                break;
+            case READ_NODE: {
+                const char *name = symbolTable->names->Name(pflat->value[i]);
+                fprintf(file, "int %s;\n", name);
+                fprintf(file, "cout << \"Enter %s: \";", name);
+                fprintf(file, "cin >> %s;\n", name);
+                break;
+            }
+            case OPER_NODE: {
+                const char *oper_str = OperCode((TokenType) node->oper);
+                if (node->oper == POWER && pflat->nodes[child[1]].kind == NUM_NODE && pflat->value[child[1]] >= 0) {
+                    SimulatePowerStart(file, pflat->value[child[1]]);
+                    parts[num_parts++] = {child[0], 0};
+                    parts[num_parts++] = {0, ")"};
+                } else if (node->oper == POWER) {
+                    fprintf(file, "IntPow(");
+                    parts[num_parts++] = {child[0], 0};
+                    parts[num_parts++] = {0, ","};
+                    parts[num_parts++] = {child[1], 0};
+                    parts[num_parts++] = {0, ")"};
+                } else if (oper_str) {
+                    bool paren[2];
+                    for (k = 0; k < 2; k++) paren[k] = pflat->nodes[child[k]].kind == OPER_NODE;
+                    if (paren[0]) parts[num_parts++] = {0, "("};
+                    parts[num_parts++] = {child[0], 0};
+                    if (paren[0]) parts[num_parts++] = {0, ")"};
+                    parts[num_parts++] = {0, oper_str};
+                    if (paren[1]) parts[num_parts++] = {0, "("};
+                    parts[num_parts++] = {child[1], 0};
+                    if (paren[1]) parts[num_parts++] = {0, ")"};
+                }
+                break;
+            }
+            case NUM_NODE:
+                fprintf(file, "%d", pflat->value[i]);
+                break;
+            case ID_NODE:
+                handleIdDatatype(file, pflat, i);
+                fprintf(file, "%s", symbolTable->names->Name(pflat->value[i]));
+                break;
+            default:
+                break;
+        }
+
+        for (k = num_parts - 1; k >= 0; k--) if (parts[k].text || parts[k].node) stack.push_back(parts[k]);
+    }
+}
+
+void SimulateProgram(SymbolTable *symbolTable, const FlatTree *pflat) {
+    FILE *simulationFile = fopen("simulation.cpp", "w");
+    SimulateProgramStart(simulationFile);
+    SimulateNode(simulationFile, symbolTable, pflat);
+    SimulateProgramEnd(simulationFile);
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+// Cache ///////////////////////////////////////////////////////////////////////////
+
+// The checked flat tree, the identifier names, the symbol table and the type errors of a program are saved
+// in one file of the cache directory, named by a hash of the source and of the compiler build. Compiling the
+// same source again maps that file and skips scanning, parsing and checking.
+// The file is the CacheHeader, then the arrays below, each starting at a multiple of 8 bytes:
+//   FlatNode nodes[num_nodes], int line_num[num_nodes], int value[num_nodes], int slot[num_nodes],
+//   ReportedTypeError type_errors[num_type_errors], char chars[num_chars], int name_start[num_ids],
+//   CachedVariable vars[num_vars], int lines[num_lines] (the lines of the vars one after the other)
+
+#define CACHE_MAGIC 0x33545341594e4954ull // "TINYAST3", changes with the file layout
+#define CACHE_DIR "tiny_cache"
+
+// A new build may compile differently, so it does not read the files of an older one
+const char *const compiler_version = "TINY " __DATE__ " " __TIME__;
+
+struct CacheHeader {
+    unsigned long long magic;
+    unsigned long long key;
+    unsigned num_nodes, num_type_errors, num_chars, num_ids, num_vars, num_lines;
+};
+
+struct CachedVariable {
+    int id;
+    int memloc;
+    int num_lines;
+};
+
+// The offset of each array in the file
+struct CacheLayout {
+    size_t nodes, line_num, value, slot, type_errors, chars, name_start, vars, lines, size;
+
+    static size_t Align(size_t n) { return (n + 7) & ~(size_t) 7; }
+
+    CacheLayout(const CacheHeader *h) {
+        nodes = Align(sizeof(CacheHeader));
+        line_num = Align(nodes + h->num_nodes * sizeof(FlatNode));
+        value = Align(line_num + h->num_nodes * sizeof(int));
+        slot = Align(value + h->num_nodes * sizeof(int));
+        type_errors = Align(slot + h->num_nodes * sizeof(int));
+        chars = Align(type_errors + h->num_type_errors * sizeof(ReportedTypeError));
+        name_start = Align(chars + h->num_chars);
+        vars = Align(name_start + h->num_ids * sizeof(int));
+        lines = Align(vars + h->num_vars * sizeof(CachedVariable));
+        size = lines + h->num_lines * sizeof(int);
+    }
+};
+
+// A loaded cache file, unmapped when the compiler is done with the tree
+struct CacheFile {
+    char *map_buf;
+    size_t map_size;
+
+    CacheFile() {
+        map_buf = 0;
+        map_size = 0;
+    }
+
+    ~CacheFile() {
+#ifdef TINY_HAVE_MMAP
+        if (map_buf) munmap(map_buf, map_size);
+#endif
+    }
+};
+
+// The key of the source in pin, which must be mapped
+unsigned long long CacheKey(const InFile *pin) {
+    unsigned long long h = HashBytes(14695981039346656037ull, compiler_version, strlen(compiler_version));
+    return HashBytes(h, pin->map_buf, pin->map_len);
+}
+
+void CachePath(char *path, const char *dir, unsigned long long key) {
+    sprintf(path, "%s/%016llx.ast", dir, key);
+}
+
+// Writes n bytes and the zero bytes up to the next multiple of 8
+void WriteCacheArray(FILE *file, const void *p, size_t n) {
+    static const char zeros[8] = {0};
+    fwrite(p, 1, n, file);
+    fwrite(zeros, 1, CacheLayout::Align(n) - n, file);
+}
+
+// Saves the checked tree of the source with the given key. The file is written under a temporary name and
+// renamed, so a compiler reading the cache never sees half a file. Failing to save is not an error.
+// Without mmap the cache is never read, so it is not written either.
+void SaveCache(const char *dir, unsigned long long key, const Interner *names, SymbolTable *symbolTable,
+               const FlatTree *pflat) {
+#ifdef TINY_HAVE_MMAP
+    CacheHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = CACHE_MAGIC;
+    header.key = key;
+    header.num_nodes = pflat->Size();
+    header.num_type_errors = pflat->type_errors.size();
+    header.num_chars = names->chars.size();
+    header.num_ids = names->NumIds();
+
+    vector<CachedVariable> vars;
+    vector<int> lines;
+    int i;
+    for (i = 0; i < (int) symbolTable->var_info.size(); i++) {
+        VariableInfo *curv = symbolTable->var_info[i];
+        if (!curv) continue;
+        CachedVariable var = {curv->id, curv->memloc, 0};
+        LineChunk *chunk;
+        for (chunk = curv->head_chunk; chunk; chunk = chunk->next) {
+            lines.insert(lines.end(), chunk->line_num, chunk->line_num + chunk->count);
+            var.num_lines += chunk->count;
+        }
+        vars.push_back(var);
+    }
+    header.num_vars = vars.size();
+    header.num_lines = lines.size();
+
+    mkdir(dir, 0777);
+    char path[1024], temp_path[1100];
+    CachePath(path, dir, key);
+    sprintf(temp_path, "%s.%d", path, (int) getpid());
+    FILE *file = fopen(temp_path, "wb");
+    if (!file) return;
+
+    WriteCacheArray(file, &header, sizeof(header));
+    WriteCacheArray(file, pflat->nodes, header.num_nodes * sizeof(FlatNode));
+    WriteCacheArray(file, pflat->line_num, header.num_nodes * sizeof(int));
+    WriteCacheArray(file, pflat->value, header.num_nodes * sizeof(int));
+    WriteCacheArray(file, pflat->slot, header.num_nodes * sizeof(int));
+    WriteCacheArray(file, pflat->type_errors.data(), header.num_type_errors * sizeof(ReportedTypeError));
+    WriteCacheArray(file, names->chars.data(), header.num_chars);
+    WriteCacheArray(file, names->name_start.data(), header.num_ids * sizeof(int));
+    WriteCacheArray(file, vars.data(), header.num_vars * sizeof(CachedVariable));
+    WriteCacheArray(file, lines.data(), header.num_lines * sizeof(int));
+
+    bool ok = !ferror(file);
+    if (fclose(file) != 0) ok = false;
+    if (!ok || rename(temp_path, path) != 0) remove(temp_path);
+#endif
+}
+
+// Maps the cached tree of the source with the given key into pcache. On success points pflat into the
+// mapping and fills the names (enough of the Interner for printing, not for interning) and the symbol table.
+// Returns false if there is no usable cache file.
+bool LoadCache(const char *dir, unsigned long long key, CacheFile *pcache, Interner *names,
+               SymbolTable *symbolTable, FlatTree *pflat) {
+#ifdef TINY_HAVE_MMAP
+    char path[1024];
+    CachePath(path, dir, key);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    void *p = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && (size_t) st.st_size >= sizeof(CacheHeader))
+        p = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) return false;
+    pcache->map_buf = (char *) p;
+    pcache->map_size = st.st_size;
+
+    const CacheHeader *header = (const CacheHeader *) p;
+    CacheLayout layout(header);
+    if (header->magic != CACHE_MAGIC || header->key != key || layout.size != (size_t) st.st_size) return false;
+
+    // the passes that run on a cached tree only read it
+    char *buf = pcache->map_buf;
+    pflat->nodes = (FlatNode *) &buf[layout.nodes];
+    pflat->line_num = (int *) &buf[layout.line_num];
+    pflat->value = (int *) &buf[layout.value];
+    pflat->slot = (int *) &buf[layout.slot];
+    pflat->size = header->num_nodes;
+    const ReportedTypeError *type_errors = (const ReportedTypeError *) &buf[layout.type_errors];
+    pflat->type_errors.assign(type_errors, type_errors + header->num_type_errors);
+
+    names->chars.assign(&buf[layout.chars], &buf[layout.chars + header->num_chars]);
+    const int *name_start = (const int *) &buf[layout.name_start];
+    names->name_start.assign(name_start, name_start + header->num_ids);
+
+    const CachedVariable *vars = (const CachedVariable *) &buf[layout.vars];
+    const int *lines = (const int *) &buf[layout.lines];
+    unsigned i;
+    int j;
+    for (i = 0; i < header->num_vars; i++) {
+        for (j = 0; j < vars[i].num_lines; j++) symbolTable->Insert(vars[i].id, *lines++);
+        symbolTable->Find(vars[i].id)->memloc = vars[i].memloc;
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+void PrintTypeErrors(const FlatTree *pflat) {
+    size_t i;
+    for (i = 0; i < pflat->type_errors.size(); i++)
+        PrintTypeError((TypeError) pflat->type_errors[i].error, pflat->type_errors[i].line_num);
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+// Pass Statistics /////////////////////////////////////////////////////////////////
+
+// The time and the cache misses of each pass, compiled in with g++ -DTINY_PASS_STATS=1 and shown on stderr as each
+// pass ends, to compare the passes over the pointer tree and over the FlatTree (bench/passes.sh). The misses are
+// those of the last level cache counted by the kernel, "-" where it has no such counter (or forbids it).
+#ifndef TINY_PASS_STATS
+#define TINY_PASS_STATS 0
+#endif
+
+#if TINY_PASS_STATS
+struct PassStats {
+    int fd; // the cache miss counter, -1 if none
+    chrono::steady_clock::time_point start;
+    unsigned long long start_misses;
+
+    PassStats() {
+        fd = -1;
+#ifdef TINY_HAVE_PERF_EVENTS
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.inherit = 1; // the scanning threads of -jN
+        fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+        Start();
+    }
+
+    unsigned long long Misses() {
+        unsigned long long misses = 0;
+        if (fd >= 0 && read(fd, &misses, sizeof(misses)) != sizeof(misses)) misses = 0;
+        return misses;
+    }
+
+    void Start() {
+        fflush(stdout);
+        start_misses = Misses();
+        start = chrono::steady_clock::now();
+    }
+
+    // Prints the statistics of the pass since Start() and starts the next one
+    void Stop(const char *pass) {
+        fflush(stdout);
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        unsigned long long misses = Misses() - start_misses;
+        if (fd >= 0) fprintf(stderr, "pass %-10s %10.4f s %14llu cache misses\n", pass, seconds, misses);
+        else fprintf(stderr, "pass %-10s %10.4f s %14s cache misses\n", pass, seconds, "-");
+        Start();
+    }
+};
+
+PassStats pass_stats;
+
+#define PASS_START() pass_stats.Start()
+#define PASS_STOP(pass) pass_stats.Stop(pass)
+#else
+#define PASS_START() ((void) 0)
+#define PASS_STOP(pass) ((void) 0)
+#endif
+
+// code_gen [input file] [options], the input file is input.txt by default
+// -prescan    scan the whole source before parsing
+// -jN         scan the whole source before parsing, on N threads
+// -scan       only scan the whole source (on the threads of -jN) and print the number of tokens and the
+//             kernels of SelectScanKernels(), to time the scanner (bench/scan.sh)
+// -stream     emit code statement by statement while reading the source
+// -flat       run the passes over a FlatTree copy of the syntax tree
+// -cache      like -flat, reusing the checked tree of an unchanged source from CACHE_DIR
+// -elf        write the executable simulation instead of simulation.cpp
+// -asm        write the assembly source simulation.s instead of simulation.cpp
+// -run        run the program instead of writing simulation.cpp (and printing the tree and symbol table)
+//             on the register VM; -run=tree runs it on the tree, -run=stack on the stack VM, -run=jit as
+//             x86-64 code
+// The input file "-" is stdin.
+int main(int argc, char **argv) {
+    const char *in_str = "input.txt";
+    bool prescan = false;
+    int scan_threads = 1;
+    bool scan = false;
+    bool stream = false;
+    bool flat = false;
+    bool cache = false;
+    bool elf = false;
+    bool assembly = false;
+    bool run = false;
+    RunEngine engine = RUN_REGISTER;
+
+    int i;
+    for (i = 1; i < argc; i++) {
+        if (Equals(argv[i], "-prescan")) prescan = true;
+        else if (StartsWith(argv[i], "-j") && atoi(&argv[i][2]) > 0) {
+            prescan = true;
+            scan_threads = atoi(&argv[i][2]);
+        } else if (Equals(argv[i], "-scan")) scan = true;
+        else if (Equals(argv[i], "-stream")) stream = true;
+        else if (Equals(argv[i], "-flat")) flat = true;
+        else if (Equals(argv[i], "-cache")) cache = true;
+        else if (Equals(argv[i], "-elf")) elf = true;
+        else if (Equals(argv[i], "-asm")) assembly = true;
+        else if (Equals(argv[i], "-run")) run = true;
+        else if (Equals(argv[i], "-run=tree")) {
+            run = true;
+            engine = RUN_TREE;
+        } else if (Equals(argv[i], "-run=stack")) {
+            run = true;
+            engine = RUN_STACK;
+        } else if (Equals(argv[i], "-run=register")) {
+            run = true;
+            engine = RUN_REGISTER;
+        } else if (Equals(argv[i], "-run=jit")) {
+            run = true;
+            engine = RUN_JIT;
+        }
+        else if (argv[i][0] == '-' && argv[i][1]) {
+            fprintf(stderr, "Unknown option %s\n", argv[i]);
+            return 1;
+        } else in_str = argv[i];
+    }
+
+    if ((run || elf || assembly) && (stream || flat || cache)) {
+        fprintf(stderr, "-run, -elf and -asm can not be combined with -stream, -flat or -cache\n");
+        return 1;
+    }
+    if (scan && (run || elf || assembly || stream || flat || cache)) {
+        fprintf(stderr, "-scan can only be combined with -jN\n");
+        return 1;
+    }
+    if (run + elf + assembly > 1) {
+        fprintf(stderr, "Only one of -run, -elf and -asm can be given\n");
+        return 1;
+    }
+#ifndef TINY_HAVE_JIT
+    if (run && engine == RUN_JIT) {
+        fprintf(stderr, "-run=jit needs x86-64 and mmap\n");
+        return 1;
+    }
+#endif
+
+    // streaming reads line by line, a mapping would keep the source in memory
+    CompilerInfo *ci = new CompilerInfo(in_str, "output.txt", "debug.txt", !stream);
+
+    try {
+        if (scan) {
+            TokenArray token_array;
+            ScanAllParallel(ci, &token_array, scan_threads);
+            printf("%zu tokens, %s kernels\n", token_array.tokens.size(), scan_kernels.name);
+        } else if (stream) SimulateStream(ci);
+        else if (flat || cache) {
+            FlatTree flat_tree;
+            CacheFile cache_file;
+            auto *symbolTable = new SymbolTable(&ci->names);
+
+            // only a mapped source can be hashed before it is compiled
+            bool use_cache = cache && ci->in_file.map_buf;
+            unsigned long long key = use_cache ? CacheKey(&ci->in_file) : 0;
+
+            PASS_START();
+            if (use_cache && LoadCache(CACHE_DIR, key, &cache_file, &ci->names, symbolTable, &flat_tree)) {
+                PrintTypeErrors(&flat_tree);
+                PASS_STOP("load");
+            } else {
+                TreeNode *root = Parse(ci, prescan, scan_threads);
+                PASS_STOP("parse");
+                FlattenTree(root, &flat_tree);
+                DestroyTrees(ci);
+                PASS_STOP("flatten");
+
+                Analyze(symbolTable, &flat_tree);
+                symbolTable->AssignSlots();
+                AnnotateSlots(symbolTable, &flat_tree);
+                PASS_STOP("analyze");
+                if (use_cache) SaveCache(CACHE_DIR, key, &ci->names, symbolTable, &flat_tree);
+            }
+
+            PASS_START();
+            PrintTree(&ci->names, &flat_tree);
+            symbolTable->Print();
+            PASS_STOP("print");
+
+            SimulateProgram(symbolTable, &flat_tree);
+            PASS_STOP("simulate");
+        } else {
+            PASS_START();
+            TreeNode *root = Parse(ci, prescan, scan_threads);
+            PASS_STOP("parse");
+
+            // build the symbol table and type check the tree
+            auto *symbolTable = new SymbolTable(&ci->names);
+            Analyze(symbolTable, root);
+            symbolTable->AssignSlots();
+            PASS_STOP("analyze");
+
+            if (run) {
+                ReduceStrength(root);
+                bool ok = RunProgram(symbolTable, root, engine);
+                DumpTrace(ci);
+                return ok ? 0 : 1;
+            }
+
+            // print tree and the symbol table
+            PrintTree(&ci->names, root);
+            symbolTable->Print();
+            PASS_STOP("print");
+
+            // the printed tree has the operators of the source, see ReduceStrength() for simulation.cpp
+            if (elf || assembly) ReduceStrength(root);
+            if (elf) {
+                bool ok = WriteExecutable("simulation", &ci->names, symbolTable, root);
+                DumpTrace(ci);
+                return ok ? 0 : 1;
+            }
+            if (assembly) {
+                bool ok = WriteAssembly("simulation.s", &ci->names, symbolTable, root);
+                DumpTrace(ci);
+                return ok ? 0 : 1;
+            }
+
+            // code simulation
+            SimulateProgram(symbolTable, root);
+            PASS_STOP("simulate");
+        }
+    } catch (...) {
+        // the end of the trace shows where compilation stopped
+        DumpTrace(ci);
+        throw;
+    }
 
-    // code simulation
-    SimulateProgram(symbolTable, root);
+    DumpTrace(ci);
     return 0;
 }
\ No newline at end of file
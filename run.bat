@@ -1,7 +1,7 @@
 @echo off
 
 rem Compile the C++ file using g++
-g++ -o code_gen code_gen.cpp
+g++ -pthread -o code_gen code_gen.cpp
 .\code_gen
 
 if %errorlevel% equ 0 (
@@ -1,7 +1,7 @@
 #!/bin/bash
 
 # Compile code_gen.cpp to generate simulation.cpp
-g++ -o code_gen code_gen.cpp
+g++ -pthread -o code_gen code_gen.cpp
 
 # Run the code_gen executable to generate simulation.cpp
 ./code_gen